@@ -0,0 +1,6 @@
+# Fail if sandboxes are left over in DIRECTORY.
+# Pool, trash, and templates are hidden directories and may still be filled or emptied in the background.
+file(GLOB SANDBOXES "${DIRECTORY}/sandbox_*")
+if(SANDBOXES)
+  message(FATAL_ERROR "sandboxes left over: ${SANDBOXES}")
+endif()
@@ -39,12 +39,18 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 
 /* supported commands
  *
  * delete name - deletes "name"
  * new name [content] - creates "name" and writes "content" to it (if defined)
+ * sparse name size content - creates "name" with a hole of "size" bytes followed by "content"
+ * sparse-check name - fails unless "name" takes up less space on disk than its size
  */
 
 int main(int argc, char *argv[]) {
@@ -80,6 +86,49 @@ int main(int argc, char *argv[]) {
 		return 1;
 	    }
 	}
+	else if (strcmp(argv[i], "sparse") == 0) {
+	    FILE *out;
+	    if (i + 3 >= argc) {
+		fprintf(stderr, "not enough arguments for sparse");
+		return 1;
+	    }
+	    if ((out=fopen(argv[i+1], "w")) == NULL) {
+		fprintf(stderr, "error creating '%s': %s", argv[i+1], strerror(errno));
+		return 1;
+	    }
+	    /* seeking past the end leaves a hole */
+	    if (fseek(out, atol(argv[i+2]), SEEK_SET) < 0 || fprintf(out, "%s", argv[i+3]) < 0) {
+		fprintf(stderr, "error writing to '%s': %s", argv[i+1], strerror(errno));
+		return 1;
+	    }
+	    if (fclose(out) < 0) {
+		fprintf(stderr, "error closing '%s': %s", argv[i+1], strerror(errno));
+		return 1;
+	    }
+	    i += 3;
+	}
+	else if (strcmp(argv[i], "sparse-check") == 0) {
+	    if (++i == argc) {
+		fprintf(stderr, "not enough arguments for sparse-check");
+		return 1;
+	    }
+#ifdef _WIN32
+	    fprintf(stderr, "can't check whether '%s' is sparse", argv[i]);
+	    return 1;
+#else
+	    {
+		struct stat st;
+		if (stat(argv[i], &st) < 0) {
+		    fprintf(stderr, "error getting size of '%s': %s", argv[i], strerror(errno));
+		    return 1;
+		}
+		if ((off_t)st.st_blocks * 512 >= st.st_size) {
+		    fprintf(stderr, "'%s' is not sparse", argv[i]);
+		    return 1;
+		}
+	    }
+#endif
+	}
     }
     return 0;
 }
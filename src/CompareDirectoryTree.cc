@@ -0,0 +1,153 @@
+/*
+  CompareDirectoryTree.cc -- compare directory trees
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "CompareDirectoryTree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "Exception.h"
+#include "OS.h"
+
+bool CompareDirectoryTree::compare() {
+    std::vector<std::string> expected;
+    auto prefix_length = expected_directory.size() + OS::path_separator.size();
+    for (const auto &file : OS::list_files(expected_directory)) {
+        expected.push_back(file.substr(prefix_length));
+    }
+
+    // list_files() sorts each directory separately, but the walk below needs plain string order.
+    std::sort(expected.begin(), expected.end());
+    std::sort(got.begin(), got.end());
+
+    std::vector<std::string> missing, extra, common;
+    auto iter_expected = expected.cbegin();
+    auto iter_got = got.cbegin();
+    while (iter_expected != expected.cend() || iter_got != got.cend()) {
+        if (iter_got == got.cend() || (iter_expected != expected.cend() && *iter_expected < *iter_got)) {
+            missing.push_back(*(iter_expected++));
+        }
+        else if (iter_expected == expected.cend() || *iter_got < *iter_expected) {
+            extra.push_back(*(iter_got++));
+        }
+        else {
+            common.push_back(*iter_got);
+            iter_expected++;
+            iter_got++;
+        }
+    }
+
+    auto changed = find_changed(common);
+
+    if (missing.empty() && extra.empty() && changed.empty()) {
+        return true;
+    }
+
+    if (verbose) {
+        std::cout << "Directory tree '" << name << "' not as expected: " << missing.size() << " missing, " << extra.size() << " extra, " << changed.size() << " changed\n";
+        print_list("missing", missing);
+        print_list("extra", extra);
+        print_list("changed", changed);
+    }
+    return false;
+}
+
+
+// Find files in `common` whose contents differ, comparing several files concurrently.
+std::vector<std::string> CompareDirectoryTree::find_changed(const std::vector<std::string> &common) const {
+    std::vector<char> differs(common.size(), 0);
+    std::atomic<size_t> next(0);
+    std::mutex error_mutex;
+    std::string error;
+
+    auto worker = [&]() {
+        size_t index;
+        while ((index = next++) < common.size()) {
+            try {
+                differs[index] = !OS::compare_files(OS::append_path_component(expected_directory, common[index]), OS::append_path_component(name, common[index]));
+            }
+            catch (Exception &e) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (error.empty()) {
+                    error = e.what();
+                }
+                return;
+            }
+        }
+    };
+
+    auto workers = std::min(static_cast<size_t>(std::thread::hardware_concurrency()), common.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (!error.empty()) {
+        throw Exception(error);
+    }
+
+    std::vector<std::string> changed;
+    for (size_t i = 0; i < common.size(); i++) {
+        if (differs[i]) {
+            changed.push_back(common[i]);
+        }
+    }
+    return changed;
+}
+
+
+void CompareDirectoryTree::print_list(const std::string &what, const std::vector<std::string> &names) const {
+    // Trees can be large, don't drown the output.
+    const size_t max_names = 10;
+
+    if (names.empty()) {
+        return;
+    }
+
+    std::cout << "  " << what << ":";
+    for (size_t i = 0; i < names.size() && i < max_names; i++) {
+        std::cout << " " << names[i];
+    }
+    if (names.size() > max_names) {
+        std::cout << " ... (" << names.size() - max_names << " more)";
+    }
+    std::cout << "\n";
+}
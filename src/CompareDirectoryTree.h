@@ -0,0 +1,58 @@
+/*
+  CompareDirectoryTree.h -- compare directory trees
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef HAD_COMPARE_DIRECTORY_TREE_H
+#define HAD_COMPARE_DIRECTORY_TREE_H
+
+#include <string>
+#include <vector>
+
+class CompareDirectoryTree {
+public:
+    // Compare files `got`, relative to directory `name`, with the files in `expected_directory`.
+    CompareDirectoryTree(const std::string &name_, const std::string &expected_directory_, const std::vector<std::string> &got_, bool verbose_) : name(name_), expected_directory(expected_directory_), got(got_), verbose(verbose_) { }
+
+    bool compare();
+
+private:
+    std::vector<std::string> find_changed(const std::vector<std::string> &common) const;
+    void print_list(const std::string &what, const std::vector<std::string> &names) const;
+
+    std::string name;
+    std::string expected_directory;
+    std::vector<std::string> got;
+    bool verbose;
+};
+
+#endif // HAD_COMPARE_DIRECTORY_TREE_H
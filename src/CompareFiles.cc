@@ -35,6 +35,9 @@
 
 #include <iostream>
 
+#include "DataSource.h"
+#include "Digest.h"
+#include "Exception.h"
 #include "OS.h"
 
 bool CompareFiles::compare() {
@@ -52,14 +55,21 @@ bool CompareFiles::compare() {
             
             auto compare = comparators->find(key);
             
-            if (compare != comparators->end()) {
+            if (iter_expected->read_only) {
+                // Contents are shared with the source, modification is checked by Test.
+            }
+            else if (is_untouched(iter_expected->name)) {
+                // Staged with the expected contents and not modified since.
+            }
+            else if (compare != comparators->end()) {
                 compare_files(compare->second, iter_expected->name, iter_expected->output);
             }
             else {
-                auto expected_file = test->find_file(iter_expected->output);
-                if (!OS::compare_files(expected_file, iter_expected->name)) {
+                auto expected_data = test->find_data(iter_expected->output);
+                std::string difference;
+                if (!files_equal(expected_data.get(), iter_expected->name, &difference)) {
                     print_header();
-                    std::cout << "Files '" + expected_file + "' and '" + iter_expected->name + "' differ.\n";
+                    std::cout << "Files '" + expected_data->name + "' and '" + iter_expected->name + "' differ: " + difference + ".\n";
                 }
             }
 
@@ -93,19 +103,71 @@ bool CompareFiles::compare() {
 
 
 void CompareFiles::compare_files(const std::vector<std::string> &argv, const std::string &got, const std::string &expected) {
+    auto expected_data = test->find_data(expected);
+    auto expected_file = expected_data->file_name();
+
+    std::string command_key, got_digest, expected_digest;
+    auto use_cache = test->digests.enabled();
+    if (use_cache) {
+        // The verdict also depends on the comparator itself, which may be rebuilt.
+        for (const auto &arg : argv) {
+            command_key += arg + '\0';
+        }
+        auto program = OS::append_path_component(test->build_directory, argv[0]);
+        if (test->file_index.file_exists(test->build_directory, argv[0])) {
+            auto info = OS::get_file_info(program);
+            command_key += std::to_string(info.inode) + " " + std::to_string(info.size) + " " + std::to_string(info.modification_time);
+        }
+        expected_digest = expected_file.empty() ? expected_data->known_digest() : test->digests.digest(expected_file);
+        // Without a digest of the expected contents (e.g. for compressed files), the verdict can't be cached.
+        use_cache = !expected_digest.empty();
+        if (use_cache) {
+            got_digest = Digest::file(got);
+            if (test->digests.is_known_match(command_key, got_digest, expected_digest)) {
+                return;
+            }
+        }
+    }
+
+    // The comparator needs a file to read.
+    std::string temp_directory;
+    if (expected_file.empty()) {
+        temp_directory = OS::make_temp_directory(test->build_directory, "expected_" + test->name);
+        expected_file = OS::append_path_component(temp_directory, OS::basename(expected));
+        OS::copy_file(expected_data.get(), expected_file);
+    }
+
     OS::Command command;
     command.program = argv[0];
     command.arguments.insert(command.arguments.begin(), argv.begin() + 1, argv.end());
     command.arguments.push_back(got);
-    command.arguments.push_back(test->find_file(expected));
-    command.path.push_back("..");
+    command.arguments.push_back(expected_file);
+    command.path.push_back(test->build_directory);
+    command.file_index = &test->file_index;
     
     std::vector<std::string> output;
     std::vector<std::string> error_output;
     
-    auto result = OS::run_command(&command, &output, &error_output);
-    
-    if (result != "0") {
+    std::string result;
+    try {
+        result = OS::run_command(&command, &output, &error_output);
+    }
+    catch (Exception &e) {
+        if (!temp_directory.empty()) {
+            OS::remove_directory(temp_directory);
+        }
+        throw;
+    }
+    if (!temp_directory.empty()) {
+        OS::remove_directory(temp_directory);
+    }
+
+    if (result == "0") {
+        if (use_cache) {
+            test->digests.add_match(command_key, got_digest, expected_digest);
+        }
+    }
+    else {
         print_line('!', expected);
         if (verbose) {
             for (const auto &line : output) {
@@ -119,6 +181,31 @@ void CompareFiles::compare_files(const std::vector<std::string> &argv, const std
 }
 
 
+bool CompareFiles::files_equal(DataSource *expected, const std::string &got, std::string *difference) {
+    auto expected_file = expected->file_name();
+    if (test->digests.enabled() && !expected_file.empty() && OS::get_file_info(expected_file).size == OS::get_file_info(got).size) {
+        // Only `got` has to be read, the digest of `expected_file` is usually cached.
+        if (Digest::file(got) == test->digests.digest(expected_file)) {
+            return true;
+        }
+    }
+
+    // Also used to find the first difference.
+    return OS::compare_files(expected, got, difference);
+}
+
+
+bool CompareFiles::is_untouched(const std::string &name) const {
+    auto it = staged_expected.find(name);
+    if (it == staged_expected.end()) {
+        return false;
+    }
+
+    auto info = OS::get_file_info(name);
+    return info == it->second && info.change_time == it->second.change_time;
+}
+
+
 void CompareFiles::print_header() {
     if (verbose) {
         if (ok) {
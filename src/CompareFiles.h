@@ -35,24 +35,29 @@
 #define HAD_COMPARE_FILES_H
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "Configuration.h"
+#include "OS.h"
 #include "Test.h"
 
 class CompareFiles {
 public:
-    CompareFiles(const std::vector<Test::File> &expected_, const std::vector<std::string> &got_, Test *test_, bool verbose_) : expected(expected_), got(got_), test(test_), comparators(&test_->configuration.file_compare), verbose(verbose_), ok(true) { }
+    CompareFiles(const std::vector<Test::File> &expected_, const std::vector<std::string> &got_, const std::unordered_map<std::string, OS::FileInfo> &staged_expected_, Test *test_, bool verbose_) : expected(expected_), got(got_), staged_expected(staged_expected_), test(test_), comparators(&test_->configuration.file_compare), verbose(verbose_), ok(true) { }
 
     bool compare();
     
 private:
     void compare_files(const std::vector<std::string> &argv, const std::string &got, const std::string &expected);
+    bool files_equal(DataSource *expected, const std::string &got, std::string *difference);
+    bool is_untouched(const std::string &name) const;
     void print_header();
     void print_line(char indicator, const std::string &line);
     
     const std::vector<Test::File> &expected;
     const std::vector<std::string> &got;
+    const std::unordered_map<std::string, OS::FileInfo> &staged_expected;
     FileComparators *comparators;
     Test *test;
     bool verbose;
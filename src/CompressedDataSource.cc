@@ -0,0 +1,324 @@
+/*
+  CompressedDataSource.cc -- decompress data on the fly
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "CompressedDataSource.h"
+
+#include <string.h>
+
+#include "config.h"
+
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(HAVE_LIBLZMA)
+#include <lzma.h>
+#endif
+#if defined(HAVE_LIBZSTD)
+#include <zstd.h>
+#endif
+
+#include "Exception.h"
+
+const std::vector<std::string> CompressedDataSource::extensions = {
+    ".gz",
+    ".xz",
+    ".zst"
+};
+
+namespace {
+const size_t buffer_size = 256 * 1024;
+
+struct Format {
+    std::string name;
+    std::string magic;
+};
+
+const Format gzip = { "gzip", std::string("\x1f\x8b", 2) };
+const Format xz = { "xz", std::string("\xfd" "7zXZ\0", 6) };
+const Format zstd = { "zstd", std::string("\x28\xb5\x2f\xfd", 4) };
+
+bool has_magic(const std::vector<uint8_t> &data, size_t length, const Format &format) {
+    return length >= format.magic.size() && memcmp(data.data(), format.magic.data(), format.magic.size()) == 0;
+}
+
+#if defined(HAVE_ZLIB)
+class GzipDataSource : public CompressedDataSource {
+public:
+    GzipDataSource(std::shared_ptr<DataSource> source, std::vector<uint8_t> input, size_t input_length);
+    virtual ~GzipDataSource() { inflateEnd(&stream); }
+
+    virtual size_t read(void *buffer, size_t length);
+
+private:
+    z_stream stream;
+    bool end_of_input;
+    bool in_member;
+    bool finished;
+};
+
+
+GzipDataSource::GzipDataSource(std::shared_ptr<DataSource> source, std::vector<uint8_t> input, size_t input_length) : CompressedDataSource(source, input, input_length), end_of_input(false), in_member(false), finished(false) {
+    memset(&stream, 0, sizeof(stream));
+    // 32: detect gzip or zlib header
+    if (inflateInit2(&stream, MAX_WBITS + 32) != Z_OK) {
+        throw Exception("can't initialize gzip decompression");
+    }
+    stream.next_in = this->input.data();
+    stream.avail_in = static_cast<uInt>(this->input_length);
+}
+
+
+size_t GzipDataSource::read(void *buffer, size_t length) {
+    if (finished) {
+        return 0;
+    }
+
+    stream.next_out = static_cast<Bytef *>(buffer);
+    stream.avail_out = static_cast<uInt>(length);
+
+    while (stream.avail_out > 0) {
+        if (stream.avail_in == 0 && !end_of_input) {
+            if (fill_input()) {
+                stream.next_in = input.data();
+                stream.avail_in = static_cast<uInt>(input_length);
+            }
+            else {
+                end_of_input = true;
+            }
+        }
+        if (end_of_input && !in_member) {
+            finished = true;
+            break;
+        }
+
+        auto ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            // Concatenated gzip files are valid.
+            in_member = false;
+            inflateReset(&stream);
+        }
+        else if (ret == Z_OK) {
+            in_member = true;
+        }
+        else if (ret == Z_BUF_ERROR && end_of_input) {
+            throw Exception("can't decompress '" + name + "': file is truncated");
+        }
+        else {
+            throw Exception("can't decompress '" + name + "': " + (stream.msg != NULL ? stream.msg : "error " + std::to_string(ret)));
+        }
+    }
+
+    return length - stream.avail_out;
+}
+#endif
+
+
+#if defined(HAVE_LIBLZMA)
+class XzDataSource : public CompressedDataSource {
+public:
+    XzDataSource(std::shared_ptr<DataSource> source, std::vector<uint8_t> input, size_t input_length);
+    virtual ~XzDataSource() { lzma_end(&stream); }
+
+    virtual size_t read(void *buffer, size_t length);
+
+private:
+    lzma_stream stream;
+    lzma_action action;
+    bool finished;
+};
+
+
+XzDataSource::XzDataSource(std::shared_ptr<DataSource> source, std::vector<uint8_t> input, size_t input_length) : CompressedDataSource(source, input, input_length), stream(LZMA_STREAM_INIT), action(LZMA_RUN), finished(false) {
+    if (lzma_stream_decoder(&stream, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+        throw Exception("can't initialize xz decompression");
+    }
+    stream.next_in = this->input.data();
+    stream.avail_in = this->input_length;
+}
+
+
+size_t XzDataSource::read(void *buffer, size_t length) {
+    if (finished) {
+        return 0;
+    }
+
+    stream.next_out = static_cast<uint8_t *>(buffer);
+    stream.avail_out = length;
+
+    while (stream.avail_out > 0) {
+        if (stream.avail_in == 0 && action == LZMA_RUN) {
+            if (fill_input()) {
+                stream.next_in = input.data();
+                stream.avail_in = input_length;
+            }
+            else {
+                action = LZMA_FINISH;
+            }
+        }
+
+        auto ret = lzma_code(&stream, action);
+        if (ret == LZMA_STREAM_END) {
+            finished = true;
+            break;
+        }
+        else if (ret != LZMA_OK) {
+            throw Exception("can't decompress '" + name + "': " + (ret == LZMA_BUF_ERROR ? "file is truncated" : "error " + std::to_string(ret)));
+        }
+    }
+
+    return length - stream.avail_out;
+}
+#endif
+
+
+#if defined(HAVE_LIBZSTD)
+class ZstdDataSource : public CompressedDataSource {
+public:
+    ZstdDataSource(std::shared_ptr<DataSource> source, std::vector<uint8_t> input, size_t input_length);
+    virtual ~ZstdDataSource() { ZSTD_freeDStream(stream); }
+
+    virtual size_t read(void *buffer, size_t length);
+
+private:
+    ZSTD_DStream *stream;
+    ZSTD_inBuffer in;
+    // Return value of last call to ZSTD_decompressStream(), 0 at end of frame.
+    size_t hint;
+    bool end_of_input;
+    bool finished;
+};
+
+
+ZstdDataSource::ZstdDataSource(std::shared_ptr<DataSource> source, std::vector<uint8_t> input, size_t input_length) : CompressedDataSource(source, input, input_length), hint(1), end_of_input(false), finished(false) {
+    if ((stream = ZSTD_createDStream()) == NULL) {
+        throw Exception("can't initialize zstd decompression");
+    }
+    in.src = this->input.data();
+    in.size = this->input_length;
+    in.pos = 0;
+}
+
+
+size_t ZstdDataSource::read(void *buffer, size_t length) {
+    if (finished) {
+        return 0;
+    }
+
+    ZSTD_outBuffer out = { buffer, length, 0 };
+
+    while (out.pos < out.size) {
+        if (in.pos == in.size && !end_of_input) {
+            if (fill_input()) {
+                in.src = input.data();
+                in.size = input_length;
+                in.pos = 0;
+            }
+            else {
+                end_of_input = true;
+            }
+        }
+
+        auto previous_position = out.pos;
+        hint = ZSTD_decompressStream(stream, &out, &in);
+        if (ZSTD_isError(hint)) {
+            throw Exception("can't decompress '" + name + "': " + ZSTD_getErrorName(hint));
+        }
+        if (end_of_input && out.pos == previous_position) {
+            if (hint != 0) {
+                throw Exception("can't decompress '" + name + "': file is truncated");
+            }
+            finished = true;
+            break;
+        }
+    }
+
+    return out.pos;
+}
+#endif
+}
+
+
+CompressedDataSource::CompressedDataSource(std::shared_ptr<DataSource> source_, std::vector<uint8_t> input_, size_t input_length_) : DataSource(source_->name), source(source_), input(std::move(input_)), input_length(input_length_) {
+}
+
+
+std::string CompressedDataSource::identity() const {
+    auto source_identity = source->identity();
+    return source_identity.empty() ? "" : "decompressed " + source_identity;
+}
+
+
+bool CompressedDataSource::fill_input() {
+    input_length = source->read(input.data(), input.size());
+    return input_length > 0;
+}
+
+
+std::shared_ptr<DataSource> CompressedDataSource::open(std::shared_ptr<DataSource> source) {
+    std::vector<uint8_t> input(buffer_size);
+    size_t length = 0;
+    size_t n;
+
+    // Read enough to detect the format.
+    while (length < 8 && (n = source->read(input.data() + length, input.size() - length)) > 0) {
+        length += n;
+    }
+
+    const Format *format = NULL;
+    for (const auto candidate : { &gzip, &xz, &zstd }) {
+        if (has_magic(input, length, *candidate)) {
+            format = candidate;
+        }
+    }
+
+    if (format == NULL) {
+        throw Exception("unknown compression format in '" + source->name + "'");
+    }
+#if defined(HAVE_ZLIB)
+    if (format == &gzip) {
+        return std::make_shared<GzipDataSource>(source, std::move(input), length);
+    }
+#endif
+#if defined(HAVE_LIBLZMA)
+    if (format == &xz) {
+        return std::make_shared<XzDataSource>(source, std::move(input), length);
+    }
+#endif
+#if defined(HAVE_LIBZSTD)
+    if (format == &zstd) {
+        return std::make_shared<ZstdDataSource>(source, std::move(input), length);
+    }
+#endif
+    throw Exception("can't decompress '" + source->name + "': " + format->name + " support not compiled in");
+}
@@ -0,0 +1,69 @@
+/*
+  CompressedDataSource.h -- decompress data on the fly
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef HAD_COMPRESSED_DATA_SOURCE_H
+#define HAD_COMPRESSED_DATA_SOURCE_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DataSource.h"
+
+// Decompressed contents of another DataSource.
+class CompressedDataSource : public DataSource {
+public:
+    // Extensions of compressed files, tried in this order.
+    static const std::vector<std::string> extensions;
+
+    // Get decompressed contents of `source`. The compression format is detected from its first bytes.
+    static std::shared_ptr<DataSource> open(std::shared_ptr<DataSource> source);
+
+    virtual std::string identity() const;
+    virtual int64_t size() const { return -1; }
+
+protected:
+    CompressedDataSource(std::shared_ptr<DataSource> source, std::vector<uint8_t> input, size_t input_length);
+
+    // Read more compressed data into `input`, returning false at end of data.
+    bool fill_input();
+
+    std::shared_ptr<DataSource> source;
+    std::vector<uint8_t> input;
+    size_t input_length;
+};
+
+#endif // HAD_COMPRESSED_DATA_SOURCE_H
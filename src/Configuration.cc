@@ -33,20 +33,36 @@
 
 #include "Configuration.h"
 
+#include <stdexcept>
+
 #include "Exception.h"
+#include "OS.h"
 #include "Parser.h"
 
 const std::vector<Parser::Directive> Configuration::directives = {
+    Parser::Directive("cpu-affinity", "cpus", 1, true),
     Parser::Directive("default-program", "directory", 1, true),
+    Parser::Directive("digest-cache", "file", 1, true),
     Parser::Directive("file-compare", "test-extension source-extension command [args ...]", 3, false, false, -1),
+    Parser::Directive("file-index-cache", "file", 1, true),
+    Parser::Directive("fixture-archive", "file", 1, true),
+    Parser::Directive("generated-cache", "directory", 1, true),
     Parser::Directive("keep-sandbox", "when", 1, true),
+    Parser::Directive("nice", "increment", 1, true),
     Parser::Directive("print-results", "when", 1, true),
-    Parser::Directive("sandbox-directory", "directory", 1, true),
+    Parser::Directive("process-isolation", "mode", 1, true),
+    Parser::Directive("record-noise", "when", 1, true),
+    Parser::Directive("sandbox-backend", "backend", 1, true),
+    Parser::Directive("sandbox-cleanup", "mode", 1, true),
+    Parser::Directive("sandbox-directory", "directory [weight]", 1, false, false, 2),
+    Parser::Directive("sandbox-pool", "size", 1, true),
+    Parser::Directive("sandbox-template", "minimum-size [maximum-total-size]", 1, true, false, 2),
+    Parser::Directive("scheduling", "policy", 1, true),
     Parser::Directive("source-directory", "directory", 1, true),
     Parser::Directive("top-build-directory", "directory", 1, true)
 };
 
-Configuration::Configuration(const std::string &file_name) : keep_sandbox(NEVER), print_results(WHEN_FAILED) {
+Configuration::Configuration(const std::string &file_name) : automatic_cpu_affinity(false), batch_scheduling(false), background_cleanup(false), file_index_cache(".nihtest-file-index"), generated_cache(".nihtest-generated"), isolate_processes(true), keep_sandbox(NEVER), memory_sandboxes(false), nice(0), print_results(WHEN_FAILED), record_noise(NEVER), sandbox_pool(0), sandbox_template_size(-1), sandbox_templates_max(1024 * 1024 * 1024) {
     auto ignore_errors = true;
     
     try {
@@ -63,9 +79,23 @@ Configuration::Configuration(const std::string &file_name) : keep_sandbox(NEVER)
 
 
 void Configuration::process_directive(const Parser::Directive *directive, const std::vector<std::string> &args) {
-    if (directive->name == "default-program") {
+    if (directive->name == "cpu-affinity") {
+        if (args[0] == "auto") {
+            automatic_cpu_affinity = true;
+        }
+        else {
+            cpu_affinity = OS::parse_cpu_list(args[0]);
+        }
+    }
+    else if (directive->name == "default-program") {
         default_program = args[0];
     }
+    else if (directive->name == "digest-cache") {
+        digest_cache = args[0];
+    }
+    else if (directive->name == "fixture-archive") {
+        fixture_archive = args[0];
+    }
     else if (directive->name == "file-compare") {
         std::string key = args[0] + "." + args[1];
         if (file_compare.find(key) != file_compare.end()) {
@@ -75,14 +105,130 @@ void Configuration::process_directive(const Parser::Directive *directive, const
         command.insert(command.begin(), args.begin() + 2, args.end());
         file_compare[key] = command;
     }
+    else if (directive->name == "file-index-cache") {
+        file_index_cache = args[0];
+    }
+    else if (directive->name == "generated-cache") {
+        generated_cache = args[0];
+    }
     else if (directive->name == "keep-sandbox") {
         keep_sandbox = get_when(args[0]);
     }
+    else if (directive->name == "nice") {
+        try {
+            size_t end;
+            nice = std::stoi(args[0], &end);
+            if (end != args[0].size()) {
+                throw Exception("invalid nice increment '" + args[0] + "'");
+            }
+        }
+        catch (std::logic_error &e) {
+            throw Exception("invalid nice increment '" + args[0] + "'");
+        }
+    }
     else if (directive->name == "print-results") {
         print_results = get_when(args[0]);
     }
+    else if (directive->name == "process-isolation") {
+        if (args[0] == "auto") {
+            isolate_processes = true;
+        }
+        else if (args[0] == "off") {
+            isolate_processes = false;
+        }
+        else {
+            throw Exception("unknown process isolation mode '" + args[0] + "'");
+        }
+    }
+    else if (directive->name == "record-noise") {
+        record_noise = get_when(args[0]);
+    }
+    else if (directive->name == "sandbox-backend") {
+        if (args[0] == "directory") {
+            memory_sandboxes = false;
+        }
+        else if (args[0] == "tmpfs") {
+            memory_sandboxes = true;
+        }
+        else {
+            throw Exception("unknown sandbox backend '" + args[0] + "'");
+        }
+    }
+    else if (directive->name == "sandbox-cleanup") {
+        if (args[0] == "background") {
+            background_cleanup = true;
+        }
+        else if (args[0] == "immediate") {
+            background_cleanup = false;
+        }
+        else {
+            throw Exception("unknown sandbox cleanup mode '" + args[0] + "'");
+        }
+    }
     else if (directive->name == "sandbox-directory") {
-        sandbox_directory = args[0];
+        for (const auto &root : sandbox_directories) {
+            if (root.directory == args[0]) {
+                throw Exception("duplicate sandbox-directory '" + args[0] + "'");
+            }
+        }
+        double weight = 1;
+        if (args.size() > 1) {
+            try {
+                size_t end;
+                weight = std::stod(args[1], &end);
+                if (end != args[1].size() || !(weight > 0)) {
+                    throw Exception("invalid sandbox directory weight '" + args[1] + "'");
+                }
+            }
+            catch (std::logic_error &e) {
+                throw Exception("invalid sandbox directory weight '" + args[1] + "'");
+            }
+        }
+        sandbox_directories.push_back(SandboxDirectory(args[0], weight));
+    }
+    else if (directive->name == "sandbox-pool") {
+        try {
+            size_t end;
+            auto size = std::stoi(args[0], &end);
+            if (end != args[0].size() || size < 0) {
+                throw Exception("invalid sandbox pool size '" + args[0] + "'");
+            }
+            sandbox_pool = static_cast<size_t>(size);
+        }
+        catch (std::logic_error &e) {
+            throw Exception("invalid sandbox pool size '" + args[0] + "'");
+        }
+    }
+    else if (directive->name == "sandbox-template") {
+        std::vector<int64_t> sizes;
+        for (const auto &arg : args) {
+            try {
+                size_t end;
+                auto size = std::stoll(arg, &end);
+                if (end != arg.size() || size < 0) {
+                    throw Exception("invalid sandbox template size '" + arg + "'");
+                }
+                sizes.push_back(size);
+            }
+            catch (std::logic_error &e) {
+                throw Exception("invalid sandbox template size '" + arg + "'");
+            }
+        }
+        sandbox_template_size = sizes[0];
+        if (sizes.size() > 1) {
+            sandbox_templates_max = sizes[1];
+        }
+    }
+    else if (directive->name == "scheduling") {
+        if (args[0] == "batch") {
+            batch_scheduling = true;
+        }
+        else if (args[0] == "normal") {
+            batch_scheduling = false;
+        }
+        else {
+            throw Exception("unknown scheduling policy '" + args[0] + "'");
+        }
     }
     else if (directive->name == "source-directory") {
         source_directory = args[0];
@@ -49,15 +49,43 @@ public:
         WHEN_FAILED,
         ALWAYS
     };
+
+    struct SandboxDirectory {
+        std::string directory;
+        // Share of sandboxes placed in `directory`, relative to the other sandbox directories.
+        double weight;
+
+        SandboxDirectory(const std::string &directory_, double weight_) : directory(directory_), weight(weight_) { }
+    };
     
     Configuration(const std::string &file_name);
     virtual void process_directive(const Parser::Directive *directive, const std::vector<std::string> &args);
 
+    bool automatic_cpu_affinity;
+    bool batch_scheduling;
+    bool background_cleanup;
+    std::vector<int> cpu_affinity;
     std::string default_program;
+    std::string digest_cache;
     FileComparators file_compare;
+    // File in which listings of build and source directories are shared between runs.
+    std::string file_index_cache;
+    std::string fixture_archive;
+    // Directory in which output of `file-generated` commands is cached.
+    std::string generated_cache;
+    bool isolate_processes;
     When keep_sandbox;
+    bool memory_sandboxes;
+    int nice;
     When print_results;
-    std::string sandbox_directory;
+    When record_noise;
+    // Directories to create sandboxes in, the current directory if empty.
+    std::vector<SandboxDirectory> sandbox_directories;
+    size_t sandbox_pool;
+    // Minimum size of staged files to create sandboxes from templates, -1 to disable.
+    int64_t sandbox_template_size;
+    // Maximum total size of templates, the least recently used ones are removed beyond it.
+    int64_t sandbox_templates_max;
     std::string source_directory;
     std::string top_build_directory;
     
@@ -0,0 +1,83 @@
+/*
+  DataSource.cc -- contents of input and expected files
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "DataSource.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "Exception.h"
+#include "OS.h"
+
+FileDataSource::FileDataSource(const std::string &name) : DataSource(name) {
+}
+
+
+std::string FileDataSource::identity() const {
+    auto info = OS::get_file_info(name);
+    auto file_name = OS::is_absolute(name) ? name : OS::append_path_component(OS::current_directory(), name);
+    return "file " + std::to_string(info.device) + " " + std::to_string(info.inode) + " " + std::to_string(info.size) + " " + std::to_string(info.modification_time) + " " + file_name;
+}
+
+
+int64_t FileDataSource::size() const {
+    return static_cast<int64_t>(OS::get_file_info(name).size);
+}
+
+
+size_t FileDataSource::read(void *buffer, size_t length) {
+    // Often only the file name is used, so open it only when needed.
+    if (!file.is_open()) {
+        file.open(name, std::ios::binary);
+        if (!file) {
+            throw Exception("cannot open '" + name + "'", true);
+        }
+    }
+    if (file.eof()) {
+        return 0;
+    }
+    file.read(static_cast<char *>(buffer), length);
+    if (file.bad()) {
+        throw Exception("error reading from '" + name + "'", true);
+    }
+    return static_cast<size_t>(file.gcount());
+}
+
+
+size_t MemoryDataSource::read(void *buffer, size_t length) {
+    auto n = static_cast<size_t>(std::min(static_cast<uint64_t>(length), data_size - offset));
+    memcpy(buffer, data + offset, n);
+    offset += n;
+    return n;
+}
@@ -0,0 +1,103 @@
+/*
+  DataSource.h -- contents of input and expected files
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef HAD_DATA_SOURCE_H
+#define HAD_DATA_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+// Contents of an input or expected file, which may not exist as a file of its own.
+class DataSource {
+public:
+    DataSource(const std::string &name_) : name(name_) { }
+    virtual ~DataSource() { }
+
+    // Name used in messages.
+    std::string name;
+
+    // Name of file containing the data, empty if there is none.
+    virtual std::string file_name() const { return ""; }
+
+    // Size of the data in bytes, -1 if it is not known without reading all of it.
+    virtual int64_t size() const = 0;
+
+    // Digest of the data (see `Digest`) if it is known without reading it, empty otherwise.
+    virtual std::string known_digest() const { return ""; }
+
+    // String that changes whenever the data changes, empty if there is none.
+    virtual std::string identity() const { return ""; }
+
+    // Read up to `length` bytes into `buffer`, returning number of bytes read, 0 at end of data.
+    virtual size_t read(void *buffer, size_t length) = 0;
+};
+
+
+// Data from file `name`.
+class FileDataSource : public DataSource {
+public:
+    FileDataSource(const std::string &name);
+
+    virtual std::string file_name() const { return name; }
+    virtual std::string identity() const;
+    virtual int64_t size() const;
+    virtual size_t read(void *buffer, size_t length);
+
+private:
+    std::ifstream file;
+};
+
+
+// Data in memory, kept valid by `owner`.
+class MemoryDataSource : public DataSource {
+public:
+    MemoryDataSource(const std::string &name, std::shared_ptr<const void> owner_, const uint8_t *data_, uint64_t size_, const std::string &digest_ = "") : DataSource(name), owner(owner_), data(data_), data_size(size_), digest(digest_), offset(0) { }
+
+    virtual int64_t size() const { return static_cast<int64_t>(data_size); }
+    virtual std::string known_digest() const { return digest; }
+    virtual std::string identity() const { return digest.empty() ? "" : "digest " + digest; }
+    virtual size_t read(void *buffer, size_t length);
+
+private:
+    std::shared_ptr<const void> owner;
+    const uint8_t *data;
+    uint64_t data_size;
+    std::string digest;
+    uint64_t offset;
+};
+
+#endif // HAD_DATA_SOURCE_H
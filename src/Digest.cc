@@ -0,0 +1,184 @@
+/*
+  Digest.cc -- 128 bit content digest
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "Digest.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include "Exception.h"
+
+namespace {
+const uint64_t c1 = 0x87c37b91114253d5ULL;
+const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+uint64_t rotate_left(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t final_mix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+uint64_t get_uint64(const uint8_t *data, size_t length) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+        value |= static_cast<uint64_t>(data[i]) << (i * 8);
+    }
+    return value;
+}
+}
+
+
+Digest::Digest() : h1(0), h2(0), length(0), buffer_used(0) {
+}
+
+
+void Digest::update(const void *data, size_t data_length) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    length += data_length;
+
+    if (buffer_used > 0) {
+        auto n = std::min(data_length, sizeof(buffer) - buffer_used);
+        memcpy(buffer + buffer_used, bytes, n);
+        buffer_used += n;
+        bytes += n;
+        data_length -= n;
+        if (buffer_used < sizeof(buffer)) {
+            return;
+        }
+        process_block(buffer);
+        buffer_used = 0;
+    }
+
+    while (data_length >= sizeof(buffer)) {
+        process_block(bytes);
+        bytes += sizeof(buffer);
+        data_length -= sizeof(buffer);
+    }
+
+    memcpy(buffer, bytes, data_length);
+    buffer_used = data_length;
+}
+
+
+std::string Digest::final() {
+    uint64_t k1 = get_uint64(buffer, std::min(buffer_used, static_cast<size_t>(8)));
+    uint64_t k2 = buffer_used > 8 ? get_uint64(buffer + 8, buffer_used - 8) : 0;
+
+    if (buffer_used > 8) {
+        k2 *= c2;
+        k2 = rotate_left(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+    if (buffer_used > 0) {
+        k1 *= c1;
+        k1 = rotate_left(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = final_mix(h1);
+    h2 = final_mix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    // canonical byte order: both halves little endian
+    static const char hex[] = "0123456789abcdef";
+    std::string digest;
+    for (auto h : {h1, h2}) {
+        for (auto i = 0; i < 8; i++) {
+            auto byte = (h >> (i * 8)) & 0xff;
+            digest += hex[byte >> 4];
+            digest += hex[byte & 0xf];
+        }
+    }
+    return digest;
+}
+
+
+std::string Digest::file(const std::string &name) {
+    auto file = std::ifstream(name, std::ios::binary);
+    if (!file) {
+        throw Exception("cannot open '" + name + "'", true);
+    }
+
+    Digest digest;
+    std::vector<char> buffer(256 * 1024);
+    while (!file.eof()) {
+        file.read(buffer.data(), buffer.size());
+        if (file.bad()) {
+            throw Exception("error reading from '" + name + "'", true);
+        }
+        digest.update(buffer.data(), file.gcount());
+    }
+
+    return digest.final();
+}
+
+
+void Digest::process_block(const uint8_t *block) {
+    auto k1 = get_uint64(block, 8);
+    auto k2 = get_uint64(block + 8, 8);
+
+    k1 *= c1;
+    k1 = rotate_left(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+
+    h1 = rotate_left(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= c2;
+    k2 = rotate_left(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+
+    h2 = rotate_left(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+}
@@ -0,0 +1,66 @@
+/*
+  Digest.h -- 128 bit content digest
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef HAD_DIGEST_H
+#define HAD_DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// MurmurHash3 (x64, 128 bit), computed incrementally. Fast, but not cryptographically secure.
+class Digest {
+public:
+    Digest();
+
+    // Add `length` bytes at `data` to digest.
+    void update(const void *data, size_t length);
+
+    // Get digest of all data added, as hexadecimal string.
+    std::string final();
+
+    // Get digest of contents of file `name`.
+    static std::string file(const std::string &name);
+
+private:
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t length;
+    uint8_t buffer[16];
+    size_t buffer_used;
+
+    void process_block(const uint8_t *block);
+};
+
+#endif // HAD_DIGEST_H
@@ -0,0 +1,215 @@
+/*
+  DigestCache.cc -- persistent cache of file digests and comparison results
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "DigestCache.h"
+
+#include <stdio.h>
+
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "Digest.h"
+#include "Exception.h"
+
+/*
+  The cache file is a text file. After a header line, it contains lines
+    file device inode size modification-time digest name
+    match command-digest got-digest expected-digest
+*/
+
+namespace {
+const std::string header = "nihtest digest cache 1";
+}
+
+
+DigestCache::DigestCache(const std::string &file_name_) : file_name(file_name_), loaded(false), changed(false) {
+    // We change into the sandbox later.
+    if (!file_name.empty() && !OS::is_absolute(file_name)) {
+        file_name = OS::append_path_component(OS::current_directory(), file_name);
+    }
+}
+
+
+std::string DigestCache::digest(const std::string &name) {
+    auto info = OS::get_file_info(name);
+
+    if (!enabled()) {
+        return Digest::file(name);
+    }
+    load();
+
+    auto key = OS::is_absolute(name) ? name : OS::append_path_component(OS::current_directory(), name);
+    touched.insert(key);
+    auto it = files.find(key);
+    if (it != files.end() && it->second.info == info) {
+        return it->second.digest;
+    }
+
+    auto digest = Digest::file(name);
+    // It may have been modified while we read it.
+    if (OS::get_file_info(name) == info) {
+        files[key] = Entry{info, digest};
+        changed = true;
+    }
+    return digest;
+}
+
+
+bool DigestCache::is_known_match(const std::string &command, const std::string &got, const std::string &expected) {
+    if (!enabled()) {
+        return false;
+    }
+    load();
+
+    return matches.find(match_key(command, got, expected)) != matches.end();
+}
+
+
+void DigestCache::add_match(const std::string &command, const std::string &got, const std::string &expected) {
+    if (!enabled()) {
+        return;
+    }
+    load();
+
+    if (matches.insert(match_key(command, got, expected)).second) {
+        changed = true;
+    }
+}
+
+
+void DigestCache::save() {
+    if (!changed) {
+        return;
+    }
+    changed = false;
+
+    // Merge with entries other runs added since we loaded.
+    auto all_files = std::unordered_map<std::string, Entry>();
+    auto all_matches = std::unordered_set<std::string>();
+    read(file_name, &all_files, &all_matches);
+    for (const auto &file : files) {
+        all_files[file.first] = file.second;
+    }
+    all_matches.insert(matches.begin(), matches.end());
+
+    // Write to a temporary file and rename it, so readers never see a partial file.
+    std::random_device random;
+    auto temporary_name = file_name + "." + std::to_string(random());
+    {
+        auto file = std::ofstream(temporary_name);
+        if (!file) {
+            return;
+        }
+        file << header << "\n";
+        for (const auto &entry : all_files) {
+            // Don't keep entries for files that were removed; only check the ones we used, checking all of them in every test is too slow.
+            if (touched.find(entry.first) != touched.end() && !OS::file_exists(entry.first)) {
+                continue;
+            }
+            const auto &info = entry.second.info;
+            file << "file " << info.device << " " << info.inode << " " << info.size << " " << info.modification_time << " " << entry.second.digest << " " << entry.first << "\n";
+        }
+        for (const auto &match : all_matches) {
+            file << "match " << match << "\n";
+        }
+        file.close();
+        if (file.fail()) {
+            remove(temporary_name.c_str());
+            return;
+        }
+    }
+
+    if (rename(temporary_name.c_str(), file_name.c_str()) != 0) {
+        // Windows doesn't replace existing files.
+        remove(file_name.c_str());
+        if (rename(temporary_name.c_str(), file_name.c_str()) != 0) {
+            remove(temporary_name.c_str());
+        }
+    }
+}
+
+
+void DigestCache::load() {
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+
+    read(file_name, &files, &matches);
+}
+
+
+void DigestCache::read(const std::string &file_name, std::unordered_map<std::string, Entry> *files, std::unordered_set<std::string> *matches) {
+    auto file = std::ifstream(file_name);
+    if (!file) {
+        return;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != header) {
+        // unknown format, will be replaced on save
+        return;
+    }
+
+    while (std::getline(file, line)) {
+        auto stream = std::istringstream(line);
+        std::string type;
+        stream >> type;
+
+        if (type == "file") {
+            Entry entry;
+            std::string name;
+            stream >> entry.info.device >> entry.info.inode >> entry.info.size >> entry.info.modification_time >> entry.digest;
+            stream.get();
+            std::getline(stream, name);
+            if (!stream.fail() && !name.empty()) {
+                (*files)[name] = entry;
+            }
+        }
+        else if (type == "match") {
+            std::string command, got, expected;
+            stream >> command >> got >> expected;
+            if (!stream.fail()) {
+                matches->insert(command + " " + got + " " + expected);
+            }
+        }
+    }
+}
+
+
+std::string DigestCache::match_key(const std::string &command, const std::string &got, const std::string &expected) {
+    Digest digest;
+    digest.update(command.data(), command.size());
+    return digest.final() + " " + got + " " + expected;
+}
@@ -0,0 +1,84 @@
+/*
+  DigestCache.h -- persistent cache of file digests and comparison results
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef HAD_DIGEST_CACHE_H
+#define HAD_DIGEST_CACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "OS.h"
+
+// Digests of input and expected files, which rarely change, and file-compare commands known to succeed.
+// Shared between nihtest runs through a file; concurrent runs may lose each other's additions, but never corrupt it.
+class DigestCache {
+public:
+    // Use cache file `file_name`, relative to the current directory; the cache is disabled if it is empty.
+    DigestCache(const std::string &file_name);
+
+    bool enabled() const { return !file_name.empty(); }
+
+    // Get digest of `name`, computing it only if it has changed since it was cached.
+    std::string digest(const std::string &name);
+
+    // Check whether `command` is known to succeed for files with digests `got` and `expected`.
+    bool is_known_match(const std::string &command, const std::string &got, const std::string &expected);
+
+    // Record that `command` succeeded for files with digests `got` and `expected`.
+    void add_match(const std::string &command, const std::string &got, const std::string &expected);
+
+    // Write cache file if anything was added.
+    void save();
+
+private:
+    struct Entry {
+        OS::FileInfo info;
+        std::string digest;
+    };
+
+    std::string file_name;
+    bool loaded;
+    bool changed;
+    std::unordered_map<std::string, Entry> files;
+    std::unordered_set<std::string> matches;
+    // Names of files whose digest was requested in this process.
+    std::unordered_set<std::string> touched;
+
+    void load();
+    static void read(const std::string &file_name, std::unordered_map<std::string, Entry> *files, std::unordered_set<std::string> *matches);
+    static std::string match_key(const std::string &command, const std::string &got, const std::string &expected);
+};
+
+#endif // HAD_DIGEST_CACHE_H
@@ -0,0 +1,260 @@
+/*
+  FileIndex.cc -- cached directory listings
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "FileIndex.h"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+/*
+  The cache file is a text file. After a header line, it contains for each directory
+    directory modification-time name
+  followed by one line per entry
+    type name
+  where type is one of f (regular file), d (directory), o (other), or u (unknown).
+*/
+
+namespace {
+const std::string header = "nihtest file index 1";
+
+// Directories modified less than this many nanoseconds ago may still change within the resolution of their modification time.
+const int64_t recent_modification = 2000000000;
+
+const std::string type_codes = "ufdo";
+}
+
+
+FileIndex::FileIndex(const std::string &file_name_) : file_name(file_name_), loaded(false) {
+    // We change into the sandbox later.
+    if (!file_name.empty() && !OS::is_absolute(file_name)) {
+        file_name = OS::append_path_component(OS::current_directory(), file_name);
+    }
+}
+
+
+bool FileIndex::file_exists(const std::string &directory, const std::string &name) {
+    auto absolute_directory = directory.empty() ? OS::current_directory() : OS::is_absolute(directory) ? directory : OS::append_path_component(OS::current_directory(), directory);
+
+    // Walk down subdirectories in `name`, which may use either separator.
+    std::string::size_type start = 0;
+    std::string::size_type end;
+    while ((end = name.find_first_of("/" + OS::path_separator, start)) != std::string::npos) {
+        if (end > start) {
+            auto component = name.substr(start, end - start);
+            if (component != "." && get_type(absolute_directory, component) != OS::FILE_TYPE_DIRECTORY) {
+                return false;
+            }
+            absolute_directory = OS::append_path_component(absolute_directory, component);
+        }
+        start = end + 1;
+    }
+
+    return get_type(absolute_directory, name.substr(start)) == OS::FILE_TYPE_REGULAR;
+}
+
+
+// Get type of `name` in `directory`, FILE_TYPE_OTHER if it doesn't exist.
+OS::FileType FileIndex::get_type(const std::string &directory, const std::string &name) {
+    if (name == "..") {
+        return OS::FILE_TYPE_DIRECTORY;
+    }
+
+    auto it = directories.find(directory);
+    auto &entries = (it != directories.end() && it->second.checked) ? it->second : read_directory(directory);
+
+    auto entry = entries.entries.find(name);
+    if (entry == entries.entries.end()) {
+        if (entries.complete) {
+            return OS::FILE_TYPE_OTHER;
+        }
+        entry = entries.entries.insert(std::make_pair(name, OS::FILE_TYPE_UNKNOWN)).first;
+    }
+    if (entry->second == OS::FILE_TYPE_UNKNOWN) {
+        // Symbolic link, file system that doesn't report types, or directory not listed; determine once.
+        auto file_name = OS::append_path_component(directory, name);
+        entry->second = OS::file_exists(file_name) ? OS::FILE_TYPE_REGULAR : OS::directory_exists(file_name) ? OS::FILE_TYPE_DIRECTORY : OS::FILE_TYPE_OTHER;
+    }
+    return entry->second;
+}
+
+
+void FileIndex::save() {
+    if (listed.empty() && removed.empty()) {
+        return;
+    }
+
+    // Merge with listings other runs added since we loaded.
+    auto all_directories = std::unordered_map<std::string, Directory>();
+    read(file_name, &all_directories);
+    for (const auto &name : removed) {
+        all_directories.erase(name);
+    }
+    for (const auto &directory : listed) {
+        all_directories[directory.first] = directory.second;
+    }
+    listed.clear();
+    removed.clear();
+
+    // Write to a temporary file and rename it, so readers never see a partial file.
+    std::random_device random;
+    auto temporary_name = file_name + "." + std::to_string(random());
+    {
+        auto file = std::ofstream(temporary_name);
+        if (!file) {
+            return;
+        }
+        file << header << "\n";
+        for (const auto &directory : all_directories) {
+            file << "directory " << directory.second.modification_time << " " << directory.first << "\n";
+            for (const auto &entry : directory.second.entries) {
+                file << type_codes[entry.second] << " " << entry.first << "\n";
+            }
+        }
+        file.close();
+        if (file.fail()) {
+            remove(temporary_name.c_str());
+            return;
+        }
+    }
+
+    if (rename(temporary_name.c_str(), file_name.c_str()) != 0) {
+        // Windows doesn't replace existing files.
+        remove(file_name.c_str());
+        if (rename(temporary_name.c_str(), file_name.c_str()) != 0) {
+            remove(temporary_name.c_str());
+        }
+    }
+}
+
+
+void FileIndex::load() {
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+
+    if (!file_name.empty()) {
+        read(file_name, &directories);
+    }
+}
+
+
+// Get entries of `directory`, from the cache if it hasn't changed since it was listed.
+FileIndex::Directory &FileIndex::read_directory(const std::string &directory) {
+    load();
+
+    auto &entries = directories[directory];
+
+    if (!OS::directory_exists(directory)) {
+        if (entries.complete && !file_name.empty()) {
+            removed.insert(directory);
+        }
+        entries = Directory();
+        entries.checked = true;
+        entries.complete = true;
+        return entries;
+    }
+
+    auto modification_time = OS::get_file_info(directory).modification_time;
+    if (entries.complete && entries.modification_time == modification_time) {
+        entries.checked = true;
+        return entries;
+    }
+
+    entries = Directory();
+    entries.checked = true;
+    entries.modification_time = modification_time;
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (now - modification_time < recent_modification) {
+        // Look up names one by one, the listing would be outdated soon.
+        return entries;
+    }
+
+    auto cacheable = !file_name.empty();
+    for (const auto &entry : OS::list_directory_entries(directory)) {
+        entries.entries[entry.name] = entry.type;
+        if (entry.name.find('\n') != std::string::npos) {
+            cacheable = false;
+        }
+    }
+    entries.complete = true;
+    if (cacheable) {
+        listed[directory] = entries;
+    }
+    return entries;
+}
+
+
+void FileIndex::read(const std::string &file_name, std::unordered_map<std::string, Directory> *directories) {
+    auto file = std::ifstream(file_name);
+    if (!file) {
+        return;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != header) {
+        // unknown format, will be replaced on save
+        return;
+    }
+
+    Directory *directory = NULL;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 10, "directory ") == 0) {
+            auto stream = std::istringstream(line.substr(10));
+            int64_t modification_time;
+            std::string name;
+            stream >> modification_time;
+            stream.get();
+            std::getline(stream, name);
+            if (stream.fail() || name.empty()) {
+                directory = NULL;
+                continue;
+            }
+            directory = &(*directories)[name];
+            *directory = Directory();
+            directory->complete = true;
+            directory->modification_time = modification_time;
+        }
+        else if (directory != NULL && line.size() > 2 && line[1] == ' ') {
+            auto type = type_codes.find(line[0]);
+            if (type != std::string::npos) {
+                directory->entries[line.substr(2)] = static_cast<OS::FileType>(type);
+            }
+        }
+    }
+}
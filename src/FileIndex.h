@@ -0,0 +1,85 @@
+/*
+  FileIndex.h -- cached directory listings
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef HAD_FILE_INDEX_H
+#define HAD_FILE_INDEX_H
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "OS.h"
+
+// Contents of directories, each read only once, so looking up many names needs no further system calls.
+// Listings are shared between nihtest runs through a file and reused while the directory's modification time is unchanged.
+// Directories modified recently may still change, they are not listed but looked up name by name.
+class FileIndex {
+public:
+    // Use cache file `file_name`, relative to the current directory; listings are not shared if it is empty.
+    FileIndex(const std::string &file_name);
+
+    // Check whether regular file `name` exists in `directory`. `name` may contain directories.
+    bool file_exists(const std::string &directory, const std::string &name);
+
+    // Write cache file if any directory was listed.
+    void save();
+
+private:
+    struct Directory {
+        Directory() : checked(false), complete(false), modification_time(0) { }
+
+        // Whether the directory was checked to be unchanged, or read, by this process.
+        bool checked;
+        // Whether `entries` lists all entries, otherwise it only holds names looked up so far.
+        bool complete;
+        int64_t modification_time;
+        std::unordered_map<std::string, OS::FileType> entries;
+    };
+
+    std::string file_name;
+    bool loaded;
+    // Keyed by absolute path.
+    std::unordered_map<std::string, Directory> directories;
+    // Listings read by this process, as read, to be added to the cache file.
+    std::unordered_map<std::string, Directory> listed;
+    // Directories in the cache file that no longer exist.
+    std::unordered_set<std::string> removed;
+
+    OS::FileType get_type(const std::string &directory, const std::string &name);
+    void load();
+    Directory &read_directory(const std::string &directory);
+    static void read(const std::string &file_name, std::unordered_map<std::string, Directory> *directories);
+};
+
+#endif // HAD_FILE_INDEX_H
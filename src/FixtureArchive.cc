@@ -0,0 +1,196 @@
+/*
+  FixtureArchive.cc -- packed archive of test input files
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "FixtureArchive.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <vector>
+
+#include "Digest.h"
+#include "Exception.h"
+
+/*
+  All numbers are unsigned little endian.
+
+  The archive starts with a header:
+    magic "NIHPACK1"
+    number of entries (64 bit)
+    offset of index (64 bit)
+  followed by the contents of the files, and the index, which consists of one entry per file:
+    offset of contents (64 bit)
+    size of contents (64 bit)
+    digest of contents (32 hexadecimal digits, see `Digest`)
+    length of name (32 bit)
+    name, using '/' as separator
+*/
+
+namespace {
+const std::string magic = "NIHPACK1";
+const size_t header_size = 24;
+const size_t digest_length = 32;
+
+uint64_t get_uint(const uint8_t *data, size_t length) {
+    uint64_t value = 0;
+    for (size_t i = length; i > 0; i--) {
+        value = (value << 8) | data[i - 1];
+    }
+    return value;
+}
+
+void put_uint(std::string *data, uint64_t value, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        data->push_back(static_cast<char>(value & 0xff));
+        value >>= 8;
+    }
+}
+}
+
+
+FixtureArchive::FixtureArchive(const std::string &file_name_) : file_name(file_name_), file(std::make_shared<OS::MappedFile>(file_name_)) {
+    auto data = file->data;
+    auto size = file->size;
+
+    if (size < header_size || memcmp(data, magic.data(), magic.size()) != 0) {
+        throw Exception("'" + file_name + "' is not a fixture archive");
+    }
+    auto count = get_uint(data + 8, 8);
+    auto offset = get_uint(data + 16, 8);
+
+    for (uint64_t i = 0; i < count; i++) {
+        if (offset > size || size - offset < 16 + digest_length + 4) {
+            throw Exception("index of fixture archive '" + file_name + "' is truncated");
+        }
+        Entry entry;
+        entry.offset = get_uint(data + offset, 8);
+        entry.size = get_uint(data + offset + 8, 8);
+        entry.digest = std::string(reinterpret_cast<const char *>(data + offset + 16), digest_length);
+        auto name_length = get_uint(data + offset + 16 + digest_length, 4);
+        offset += 16 + digest_length + 4;
+        if (size - offset < name_length || entry.offset > size || size - entry.offset < entry.size) {
+            throw Exception("index of fixture archive '" + file_name + "' is invalid");
+        }
+        entries[std::string(reinterpret_cast<const char *>(data + offset), name_length)] = entry;
+        offset += name_length;
+    }
+}
+
+
+std::shared_ptr<DataSource> FixtureArchive::find(const std::string &name) const {
+    auto it = entries.find(name);
+    if (it == entries.end()) {
+        return NULL;
+    }
+    const auto &entry = it->second;
+    return std::make_shared<MemoryDataSource>(file_name + ":" + name, file, file->data + entry.offset, entry.size, entry.digest);
+}
+
+
+void FixtureArchive::pack(const std::string &directory_, const std::string &file_name) {
+    auto directory = directory_;
+    while (directory.size() > 1 && directory.compare(directory.size() - OS::path_separator.size(), std::string::npos, OS::path_separator) == 0) {
+        directory.resize(directory.size() - OS::path_separator.size());
+    }
+    // Sorted, so the archive is reproducible.
+    auto names = OS::list_files(directory);
+    auto prefix_length = directory == "." ? 0 : directory.size() + OS::path_separator.size();
+
+    std::unordered_map<std::string, uint64_t> offsets;
+    std::string index;
+    uint64_t offset = header_size;
+    uint64_t count = 0;
+
+    auto temp_name = file_name + ".tmp";
+    auto archive = std::ofstream(temp_name, std::ios::binary);
+    if (!archive) {
+        throw Exception("cannot create '" + temp_name + "'", true);
+    }
+    archive.write(std::string(header_size, '\0').data(), header_size);
+
+    for (const auto &full_name : names) {
+        if (full_name == file_name || full_name == temp_name) {
+            continue;
+        }
+        OS::MappedFile contents(full_name);
+        Digest digest;
+        digest.update(contents.data, contents.size);
+        auto hash = digest.final();
+
+        auto it = offsets.find(hash);
+        uint64_t entry_offset;
+        if (it != offsets.end()) {
+            entry_offset = it->second;
+        }
+        else {
+            entry_offset = offset;
+            offsets[hash] = offset;
+            archive.write(reinterpret_cast<const char *>(contents.data), contents.size);
+            offset += contents.size;
+        }
+
+        auto archive_name = full_name.substr(prefix_length);
+        if (OS::path_separator != "/") {
+            std::string::size_type pos = 0;
+            while ((pos = archive_name.find(OS::path_separator, pos)) != std::string::npos) {
+                archive_name.replace(pos, OS::path_separator.size(), "/");
+                pos += 1;
+            }
+        }
+        count += 1;
+        put_uint(&index, entry_offset, 8);
+        put_uint(&index, contents.size, 8);
+        index += hash;
+        put_uint(&index, archive_name.size(), 4);
+        index += archive_name;
+    }
+
+    archive.write(index.data(), index.size());
+
+    std::string header = magic;
+    put_uint(&header, count, 8);
+    put_uint(&header, offset, 8);
+    archive.seekp(0);
+    archive.write(header.data(), header.size());
+
+    archive.close();
+    if (archive.fail()) {
+        throw Exception("error writing to '" + temp_name + "'", true);
+    }
+
+    if (rename(temp_name.c_str(), file_name.c_str()) < 0) {
+        throw Exception("cannot rename '" + temp_name + "' to '" + file_name + "'", true);
+    }
+}
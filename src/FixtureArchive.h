@@ -0,0 +1,71 @@
+/*
+  FixtureArchive.h -- packed archive of test input files
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef HAD_FIXTURE_ARCHIVE_H
+#define HAD_FIXTURE_ARCHIVE_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "DataSource.h"
+#include "OS.h"
+
+// Input and expected files of a test suite, packed into one file, with identical contents stored only once.
+class FixtureArchive {
+public:
+    // Open archive `file_name`.
+    FixtureArchive(const std::string &file_name);
+
+    // Get contents of file `name`, NULL if it is not in the archive.
+    std::shared_ptr<DataSource> find(const std::string &name) const;
+
+    // Pack all files in `directory` into archive `file_name`.
+    static void pack(const std::string &directory, const std::string &file_name);
+
+private:
+    struct Entry {
+        uint64_t offset;
+        uint64_t size;
+        std::string digest;
+    };
+
+    std::string file_name;
+    std::shared_ptr<OS::MappedFile> file;
+    std::unordered_map<std::string, Entry> entries;
+};
+
+#endif // HAD_FIXTURE_ARCHIVE_H
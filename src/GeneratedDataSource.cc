@@ -0,0 +1,277 @@
+/*
+  GeneratedDataSource.cc -- synthetic data
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "GeneratedDataSource.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "Exception.h"
+
+namespace {
+const size_t block_size = 64 * 1024;
+const size_t max_line_length = 72;
+// Words are copied with fixed size so the copy is inlined, must be longer than the longest word.
+const size_t max_word_length = 16;
+
+const char words[64][max_word_length] = {
+    "the", "of", "and", "to", "in", "is", "that", "for",
+    "it", "as", "was", "with", "be", "by", "on", "not",
+    "he", "this", "are", "or", "his", "from", "at", "which",
+    "but", "have", "an", "had", "they", "you", "were", "their",
+    "one", "all", "we", "can", "her", "has", "there", "been",
+    "if", "more", "when", "will", "would", "who", "so", "no",
+    "test", "file", "data", "input", "output", "value", "error", "result",
+    "program", "directory", "compression", "archive", "stream", "buffer", "record", "entry"
+};
+
+const std::vector<size_t> word_lengths = []() {
+    std::vector<size_t> lengths;
+    for (auto word : words) {
+        lengths.push_back(strlen(word));
+    }
+    return lengths;
+}();
+
+const bool little_endian = []() {
+    const uint16_t value = 1;
+    uint8_t first;
+    memcpy(&first, &value, 1);
+    return first == 1;
+}();
+
+uint64_t rotate_left(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256** by David Blackman and Sebastiano Vigna, on a local copy of the state.
+class Random {
+public:
+    Random(const uint64_t *state) : s0(state[0]), s1(state[1]), s2(state[2]), s3(state[3]) { }
+
+    uint64_t next() {
+        auto result = rotate_left(s1 * 5, 7) * 9;
+        auto t = s1 << 17;
+
+        s2 ^= s0;
+        s3 ^= s1;
+        s1 ^= s2;
+        s0 ^= s3;
+        s2 ^= t;
+        s3 = rotate_left(s3, 45);
+
+        return result;
+    }
+
+    void save(uint64_t *state) const {
+        state[0] = s0;
+        state[1] = s1;
+        state[2] = s2;
+        state[3] = s3;
+    }
+
+private:
+    uint64_t s0, s1, s2, s3;
+};
+}
+
+
+GeneratedDataSource::GeneratedDataSource(const std::string &name, Pattern pattern_, uint64_t size_, uint64_t seed_) : DataSource(name), data_pattern(pattern_), data_size(size_), seed(seed_), offset(0), block_length(0), block_offset(0), line_length(0) {
+    // Expand seed with splitmix64, as recommended for xoshiro256**.
+    auto x = seed;
+    for (auto &word : state) {
+        auto z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        word = z ^ (z >> 31);
+    }
+}
+
+
+GeneratedDataSource::Pattern GeneratedDataSource::pattern(const std::string &name) {
+    if (name == "random") {
+        return RANDOM;
+    }
+    else if (name == "text") {
+        return TEXT;
+    }
+    else if (name == "zeros") {
+        return ZEROS;
+    }
+    throw Exception("unknown pattern '" + name + "'");
+}
+
+
+std::string GeneratedDataSource::identity() const {
+    return "generated " + std::to_string(data_pattern) + " " + std::to_string(data_size) + " " + std::to_string(seed);
+}
+
+
+size_t GeneratedDataSource::read(void *buffer, size_t length) {
+    auto n = static_cast<size_t>(std::min(static_cast<uint64_t>(length), data_size - offset));
+
+    if (data_pattern == ZEROS) {
+        memset(buffer, 0, n);
+    }
+    else {
+        // Generated in blocks so the data doesn't depend on the sizes of the reads.
+        auto out = static_cast<uint8_t *>(buffer);
+        auto remaining = n;
+        while (remaining > 0) {
+            if (block_offset == block_length) {
+                fill_block();
+            }
+            auto chunk = std::min(remaining, block_length - block_offset);
+            memcpy(out, block.data() + block_offset, chunk);
+            block_offset += chunk;
+            out += chunk;
+            remaining -= chunk;
+        }
+    }
+
+    offset += n;
+    return n;
+}
+
+
+void GeneratedDataSource::fill_block() {
+    block.resize(block_size);
+
+    // Work on local copies, stores into `block` could otherwise alias the members.
+    auto data = block.data();
+    size_t length = 0;
+    auto line = line_length;
+    Random random(state);
+
+    if (data_pattern == RANDOM) {
+        for (; length < block_size; length += 8) {
+            auto value = random.next();
+            if (little_endian) {
+                memcpy(data + length, &value, 8);
+            }
+            else {
+                // Same data regardless of host byte order.
+                for (auto i = 0; i < 8; i++) {
+                    data[length + i] = static_cast<uint8_t>(value >> (8 * i));
+                }
+            }
+        }
+    }
+    else {
+        // Words are not split across blocks, leave room for separator and the longest one.
+        while (length + 1 + max_word_length <= block_size) {
+            auto value = random.next();
+            for (auto i = 0; i < 10 && length + 1 + max_word_length <= block_size; i++) {
+                auto index = (value >> (6 * i)) & 0x3f;
+                auto word_length = word_lengths[index];
+                if (line > 0) {
+                    if (line + 1 + word_length > max_line_length) {
+                        data[length++] = '\n';
+                        line = 0;
+                    }
+                    else {
+                        data[length++] = ' ';
+                        line++;
+                    }
+                }
+                memcpy(data + length, words[index], max_word_length);
+                length += word_length;
+                line += word_length;
+            }
+        }
+    }
+
+    random.save(state);
+    line_length = line;
+    block_length = length;
+    block_offset = 0;
+}
+
+
+RepeatDataSource::RepeatDataSource(const std::string &name, std::function<std::shared_ptr<DataSource>()> open_, uint64_t count_, int64_t limit_) : DataSource(name), open(open_), count(count_), limit(limit_), current(open()), repetition(0), offset(0), current_empty(true) {
+}
+
+
+std::string RepeatDataSource::identity() const {
+    auto current_identity = current->identity();
+    if (current_identity.empty()) {
+        return "";
+    }
+    return "repeat " + std::to_string(count) + " " + std::to_string(limit) + " " + current_identity;
+}
+
+
+int64_t RepeatDataSource::size() const {
+    if (limit >= 0) {
+        return limit;
+    }
+    auto current_size = current->size();
+    if (current_size < 0) {
+        return -1;
+    }
+    return current_size * static_cast<int64_t>(count);
+}
+
+
+size_t RepeatDataSource::read(void *buffer, size_t length) {
+    if (limit >= 0) {
+        length = static_cast<size_t>(std::min(static_cast<uint64_t>(length), static_cast<uint64_t>(limit) - offset));
+    }
+
+    while (length > 0) {
+        if (count > 0 && repetition == count) {
+            return 0;
+        }
+        auto n = current->read(buffer, length);
+        if (n > 0) {
+            current_empty = false;
+            offset += n;
+            return n;
+        }
+        if (current_empty) {
+            if (count == 0) {
+                throw Exception("can't repeat empty '" + current->name + "'");
+            }
+            return 0;
+        }
+        repetition++;
+        if (count == 0 || repetition < count) {
+            current = open();
+            current_empty = true;
+        }
+    }
+
+    return 0;
+}
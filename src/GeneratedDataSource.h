@@ -0,0 +1,100 @@
+/*
+  GeneratedDataSource.h -- synthetic data
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef HAD_GENERATED_DATA_SOURCE_H
+#define HAD_GENERATED_DATA_SOURCE_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DataSource.h"
+
+// Data produced by a pseudo-random number generator, always the same for the same pattern, size, and seed.
+class GeneratedDataSource : public DataSource {
+public:
+    enum Pattern {
+        RANDOM, // incompressible bytes
+        TEXT, // lines of words from a small vocabulary
+        ZEROS
+    };
+
+    GeneratedDataSource(const std::string &name, Pattern pattern_, uint64_t size_, uint64_t seed_);
+
+    // Get pattern called `name`, throws if there is none.
+    static Pattern pattern(const std::string &name);
+
+    virtual std::string identity() const;
+    virtual int64_t size() const { return static_cast<int64_t>(data_size); }
+    virtual size_t read(void *buffer, size_t length);
+
+private:
+    void fill_block();
+
+    Pattern data_pattern;
+    uint64_t data_size;
+    uint64_t seed;
+    uint64_t offset;
+    uint64_t state[4];
+    std::vector<uint8_t> block;
+    size_t block_length;
+    size_t block_offset;
+    size_t line_length;
+};
+
+
+// Contents of another DataSource, repeated.
+class RepeatDataSource : public DataSource {
+public:
+    // Repeat data returned by `open` `count` times (indefinitely if 0), truncated to `limit` bytes (unless -1).
+    RepeatDataSource(const std::string &name, std::function<std::shared_ptr<DataSource>()> open_, uint64_t count_, int64_t limit_);
+
+    virtual std::string identity() const;
+    virtual int64_t size() const;
+    virtual size_t read(void *buffer, size_t length);
+
+private:
+    std::function<std::shared_ptr<DataSource>()> open;
+    uint64_t count;
+    int64_t limit;
+    std::shared_ptr<DataSource> current;
+    uint64_t repetition;
+    uint64_t offset;
+    bool current_empty;
+};
+
+#endif // HAD_GENERATED_DATA_SOURCE_H
@@ -33,23 +33,35 @@
 
 #include "OS.h"
 
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <unordered_map>
 
+#include "config.h"
+#include "DataSource.h"
 #include "Exception.h"
+#include "FileIndex.h"
 
 #define BUFFER_SIZE (1024 * 1024)
+// Seconds between samples of disk usage, unless walking the directory takes longer.
+#define DISK_USAGE_INTERVAL 0.1
 
 static nfds_t pollfds_remove(struct pollfd *fds, nfds_t nfds, nfds_t i) {
     if (i < nfds - 1) {
@@ -63,21 +75,28 @@ class Buffer {
 public:
     Buffer(const std::vector<std::string> &lines);
     Buffer(size_t size);
+    // Refilled from `source` whenever it has been written.
+    Buffer(DataSource *source);
     ~Buffer();
 
-    bool end() { return offset == size; }
+    bool end() { return offset == size && source == NULL; }
     void get_lines(std::vector<std::string> *lines);
+    size_t position() const { return consumed + offset; }
     bool write(int fd);
-    void read(int fd);
+    size_t read(int fd);
 
   private:
     char *data;
+    size_t capacity;
     size_t size;
     size_t offset;
+    DataSource *source;
+    // Bytes of previous fills.
+    size_t consumed;
 };
 
 
-Buffer::Buffer(const std::vector<std::string> &lines) : size(0), offset(0) {
+Buffer::Buffer(const std::vector<std::string> &lines) : size(0), offset(0), source(NULL), consumed(0) {
     for (const auto &line : lines) {
 	size += line.size() + 1;
     }
@@ -92,10 +111,18 @@ Buffer::Buffer(const std::vector<std::string> &lines) : size(0), offset(0) {
     }
 
     offset = 0;
+    capacity = size;
 }
 
 
-Buffer::Buffer(size_t size_) : size(size_), offset(0) {
+Buffer::Buffer(DataSource *source_) : capacity(BUFFER_SIZE), size(0), offset(0), source(source_), consumed(0) {
+    if ((data = (char *)malloc(capacity)) == NULL) {
+        throw Exception("can't allocate buffer of size " + std::to_string(capacity));
+    }
+}
+
+
+Buffer::Buffer(size_t size_) : capacity(size_), size(size_), offset(0), source(NULL), consumed(0) {
     if ((data = (char *)malloc(size)) == NULL) {                                                                                               
         throw Exception("can't allocate buffer of size " + std::to_string(size));                                                              
     }
@@ -107,7 +134,7 @@ Buffer::~Buffer() {
 }
 
 
-void
+size_t
 Buffer::read(int fd) {
     auto n = ::read(fd, data + offset, size - offset);
 
@@ -121,24 +148,44 @@ Buffer::read(int fd) {
 	// TODO: realloc instead of error?
 	throw Exception("buffer full");
     }
+
+    return static_cast<size_t>(n);
 }
 
 
 bool
 Buffer::write(int fd) {
+    if (offset == size && source != NULL) {
+        consumed += size;
+        offset = 0;
+        size = source->read(data, capacity);
+        if (size == 0) {
+            source = NULL;
+        }
+    }
     if (offset == size) {
 	return true;
     }
 
+    // `fd` is non-blocking, so this writes only as much as fits into the pipe.
     auto n = ::write(fd, data + offset, size - offset);
 
     if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return false;
+        }
+        if (errno == EPIPE) {
+            // The program closed its standard input, the rest is not needed.
+            offset = size;
+            source = NULL;
+            return true;
+        }
 	throw Exception("write error", true);
     }
 
     offset += static_cast<size_t>(n);
 
-    return offset == size;
+    return end();
 }
 
 
@@ -197,22 +244,461 @@ void Pipe::close_write() {
 }
 
 
+class Cgroup {
+public:
+    static std::shared_ptr<Cgroup> create();
+    static std::string current_directory();
+    static const std::string &delegated_directory();
+
+    Cgroup(const std::string &directory_, int procs_fd_) : procs_fd(procs_fd_), directory(directory_) { }
+    ~Cgroup();
+
+    void close_procs();
+    void get_statistics(OS::GroupStatistics *statistics);
+    void kill();
+    void set_limits(uint64_t memory_max, double cpu_max);
+
+    // cgroup.procs of the group, opened before forking so the child can move itself into the group.
+    int procs_fd;
+
+private:
+    std::string read_file(const std::string &name);
+    bool write_file(const std::string &name, const std::string &content);
+
+    std::string directory;
+};
+
+
+std::shared_ptr<Cgroup> Cgroup::create() {
+    static int count = 0;
+
+    const auto &parent = delegated_directory();
+    if (parent.empty()) {
+        return NULL;
+    }
+
+    auto directory = parent + "/command." + std::to_string(count++);
+    if (mkdir(directory.c_str(), 0755) < 0) {
+        return NULL;
+    }
+    auto fd = open((directory + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        rmdir(directory.c_str());
+        return NULL;
+    }
+
+    return std::make_shared<Cgroup>(directory, fd);
+}
+
+
+static bool write_control_file(const std::string &file_name, const std::string &content) {
+    auto fd = open(file_name.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    auto ok = ::write(fd, content.c_str(), content.size()) == static_cast<ssize_t>(content.size());
+    close(fd);
+    return ok;
+}
+
+
+static void enable_controllers(const std::string &directory) {
+    // Fails if the controller is not available to us; we then do without it.
+    for (const auto &controller : { "+cpu", "+io", "+memory" }) {
+        write_control_file(directory + "/cgroup.subtree_control", controller);
+    }
+}
+
+
+static bool has_controllers(const std::string &directory) {
+    auto file = std::ifstream(directory + "/cgroup.subtree_control");
+    std::string controller;
+    return static_cast<bool>(file >> controller);
+}
+
+
+// Remove groups left behind by nihtest processes that are gone. They are empty, so this only fails for groups still in use.
+static void remove_stale_groups(const std::string &parent) {
+    auto dir = opendir(parent.c_str());
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "nihtest.", 8) != 0) {
+            continue;
+        }
+        auto pid = static_cast<pid_t>(strtol(entry->d_name + 8, NULL, 10));
+        if (pid <= 0 || ::kill(pid, 0) == 0 || errno != ESRCH) {
+            continue;
+        }
+        auto directory = parent + "/" + entry->d_name;
+        auto children = opendir(directory.c_str());
+        if (children != NULL) {
+            struct dirent *child;
+            while ((child = readdir(children)) != NULL) {
+                if (child->d_type == DT_DIR && child->d_name[0] != '.') {
+                    rmdir((directory + "/" + child->d_name).c_str());
+                }
+            }
+            closedir(children);
+        }
+        rmdir(directory.c_str());
+    }
+    closedir(dir);
+}
+
+
+static std::string delegation_parent;
+static std::string delegation_directory;
+
+static void remove_delegated_directory() {
+    // Moving back fails if controllers were enabled in the parent; remove_stale_groups() cleans up after us then.
+    if (write_control_file(delegation_parent + "/cgroup.procs", "0")) {
+        rmdir((delegation_directory + "/self").c_str());
+        rmdir(delegation_directory.c_str());
+    }
+}
+
+
+// Get directory below which to create groups for commands, or "" if we can't enforce limits there.
+// Controllers can only be enabled in a group without processes of its own, so we move into the leaf `nihtest.<pid>/self` and create the command groups next to it.
+const std::string &Cgroup::delegated_directory() {
+    static bool initialized = false;
+
+    if (initialized) {
+        return delegation_directory;
+    }
+    initialized = true;
+
+    auto parent = current_directory();
+    if (parent.empty() || access((parent + "/cgroup.procs").c_str(), W_OK) < 0) {
+        return delegation_directory;
+    }
+    remove_stale_groups(parent);
+
+    auto directory = parent + "/nihtest." + std::to_string(getpid());
+    if (mkdir(directory.c_str(), 0755) < 0) {
+        return delegation_directory;
+    }
+    if (mkdir((directory + "/self").c_str(), 0755) < 0) {
+        rmdir(directory.c_str());
+        return delegation_directory;
+    }
+    if (!write_control_file(directory + "/self/cgroup.procs", "0")) {
+        rmdir((directory + "/self").c_str());
+        rmdir(directory.c_str());
+        return delegation_directory;
+    }
+    delegation_parent = parent;
+    delegation_directory = directory;
+    atexit(remove_delegated_directory);
+
+    // Succeeds if we were the only process in the parent.
+    enable_controllers(parent);
+    enable_controllers(directory);
+
+    if (!has_controllers(directory)) {
+        // Without controllers a group gives us neither limits nor accounting, so don't pay for creating one per command.
+        remove_delegated_directory();
+        delegation_directory = "";
+    }
+    return delegation_directory;
+}
+
+
+// Get directory of the cgroup v2 we are running in, or "" if not available.
+std::string Cgroup::current_directory() {
+    std::string mount_point;
+    std::string line;
+
+    auto mounts = std::ifstream("/proc/self/mounts");
+    while (std::getline(mounts, line)) {
+        std::string device, directory, type;
+        auto stream = std::istringstream(line);
+        if (stream >> device >> directory >> type && type == "cgroup2") {
+            mount_point = directory;
+            break;
+        }
+    }
+    if (mount_point.empty()) {
+        return "";
+    }
+
+    auto cgroups = std::ifstream("/proc/self/cgroup");
+    while (std::getline(cgroups, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            auto path = line.substr(3);
+            return path == "/" ? mount_point : mount_point + path;
+        }
+    }
+    return "";
+}
+
+
+Cgroup::~Cgroup() {
+    close_procs();
+    kill();
+    rmdir(directory.c_str());
+}
+
+
+void Cgroup::close_procs() {
+    if (procs_fd >= 0) {
+        close(procs_fd);
+        procs_fd = -1;
+    }
+}
+
+
+void Cgroup::get_statistics(OS::GroupStatistics *statistics) {
+    std::string line;
+
+    statistics->valid = true;
+    statistics->memory_peak = strtoull(read_file("memory.peak").c_str(), NULL, 10);
+
+    auto cpu = std::istringstream(read_file("cpu.stat"));
+    while (std::getline(cpu, line)) {
+        auto stream = std::istringstream(line);
+        std::string key;
+        uint64_t value;
+        if (stream >> key >> value) {
+            if (key == "usage_usec") {
+                statistics->cpu_time = value / 1e6;
+            }
+            else if (key == "user_usec") {
+                statistics->user_time = value / 1e6;
+            }
+            else if (key == "system_usec") {
+                statistics->system_time = value / 1e6;
+            }
+        }
+    }
+
+    // one line per device: major:minor rbytes=N wbytes=N rios=N wios=N ...
+    auto io = std::istringstream(read_file("io.stat"));
+    while (std::getline(io, line)) {
+        auto stream = std::istringstream(line);
+        std::string field;
+        while (stream >> field) {
+            if (field.compare(0, 7, "rbytes=") == 0) {
+                statistics->io_read_bytes += strtoull(field.c_str() + 7, NULL, 10);
+            }
+            else if (field.compare(0, 7, "wbytes=") == 0) {
+                statistics->io_write_bytes += strtoull(field.c_str() + 7, NULL, 10);
+            }
+        }
+    }
+}
+
+
+void Cgroup::kill() {
+    // cgroup.kill is not supported before Linux 5.14
+    auto kill_all = write_file("cgroup.kill", "1");
+
+    // wait until all killed processes are gone
+    for (int i = 0; i < 1000; i++) {
+        if (read_file("cgroup.events").find("populated 1") == std::string::npos) {
+            break;
+        }
+        if (!kill_all) {
+            auto procs = std::istringstream(read_file("cgroup.procs"));
+            pid_t pid;
+            while (procs >> pid) {
+                ::kill(pid, SIGKILL);
+            }
+        }
+        usleep(1000);
+    }
+}
+
+
+std::string Cgroup::read_file(const std::string &name) {
+    auto file = std::ifstream(directory + "/" + name);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+
+void Cgroup::set_limits(uint64_t memory_max, double cpu_max) {
+    if (memory_max > 0 && !write_file("memory.max", std::to_string(memory_max))) {
+        throw Exception("can't set memory limit", true);
+    }
+    if (cpu_max > 0) {
+        const int period = 100000;
+        if (!write_file("cpu.max", std::to_string(static_cast<uint64_t>(cpu_max * period)) + " " + std::to_string(period))) {
+            throw Exception("can't set CPU limit", true);
+        }
+    }
+}
+
+
+bool Cgroup::write_file(const std::string &name, const std::string &content) {
+    return write_control_file(directory + "/" + name, content);
+}
+
+
+bool OS::can_limit_process_group(bool memory, bool cpu) {
+    const auto &directory = Cgroup::delegated_directory();
+    if (directory.empty()) {
+        return false;
+    }
+
+    auto file = std::ifstream(directory + "/cgroup.subtree_control");
+    std::string controller;
+    auto have_memory = false;
+    auto have_cpu = false;
+    while (file >> controller) {
+        if (controller == "memory") {
+            have_memory = true;
+        }
+        else if (controller == "cpu") {
+            have_cpu = true;
+        }
+    }
+    return (have_memory || !memory) && (have_cpu || !cpu);
+}
+
+
+static std::vector<std::string> read_stat_fields(pid_t pid) {
+    std::vector<std::string> fields;
+    auto file = std::ifstream("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+
+    if (!std::getline(file, line)) {
+        return fields;
+    }
+    // skip pid and name, which may contain spaces
+    auto close = line.rfind(')');
+    if (close == std::string::npos) {
+        return fields;
+    }
+    auto stream = std::istringstream(line.substr(close + 1));
+    std::string field;
+    while (stream >> field) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+
+static std::vector<pid_t> list_descendants(pid_t root) {
+    std::unordered_multimap<pid_t, pid_t> children;
+    std::vector<pid_t> processes;
+
+    DIR *dir = opendir("/proc");
+    if (dir == NULL) {
+        return processes;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+            continue;
+        }
+        auto pid = static_cast<pid_t>(atoi(entry->d_name));
+        auto fields = read_stat_fields(pid);
+        if (fields.size() > 1) {
+            children.insert(std::make_pair(static_cast<pid_t>(atoi(fields[1].c_str())), pid));
+        }
+    }
+    closedir(dir);
+
+    processes.push_back(root);
+    for (size_t i = 0; i < processes.size(); i++) {
+        auto range = children.equal_range(processes[i]);
+        for (auto it = range.first; it != range.second; it++) {
+            processes.push_back(it->second);
+        }
+    }
+
+    return processes;
+}
+
+
+static OS::ProcessSample sample_processes(pid_t root, double time) {
+    OS::ProcessSample sample;
+    sample.time = time;
+
+    for (auto pid : list_descendants(root)) {
+        auto directory = "/proc/" + std::to_string(pid);
+        std::string line;
+
+        auto status = std::ifstream(directory + "/status");
+        if (!status) {
+            // process already exited
+            continue;
+        }
+        sample.processes += 1;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) {
+                sample.rss += strtoull(line.c_str() + 6, NULL, 10) * 1024;
+            }
+            else if (line.compare(0, 8, "Threads:") == 0) {
+                sample.threads += strtoull(line.c_str() + 8, NULL, 10);
+            }
+        }
+
+        auto io = std::ifstream(directory + "/io");
+        while (std::getline(io, line)) {
+            if (line.compare(0, 6, "rchar:") == 0) {
+                sample.read_bytes += strtoull(line.c_str() + 6, NULL, 10);
+            }
+            else if (line.compare(0, 6, "wchar:") == 0) {
+                sample.write_bytes += strtoull(line.c_str() + 6, NULL, 10);
+            }
+        }
+
+        DIR *fd_dir = opendir((directory + "/fd").c_str());
+        if (fd_dir != NULL) {
+            struct dirent *entry;
+            while ((entry = readdir(fd_dir)) != NULL) {
+                if (entry->d_name[0] != '.') {
+                    sample.open_files += 1;
+                }
+            }
+            closedir(fd_dir);
+        }
+    }
+
+    return sample;
+}
+
+
+bool OS::can_sample_processes() {
+    return file_exists("/proc/self/status") && directory_exists("/proc/self/fd");
+}
+
+
+static void record_transfer(OS::StreamStatistics *statistics, size_t bytes, double time) {
+    if (bytes == 0) {
+        return;
+    }
+    if (statistics->first < 0) {
+        statistics->first = time;
+    }
+    statistics->last = time;
+    statistics->bytes += bytes;
+}
+
+
 std::string OS::run_command(const Command *command, std::vector<std::string> *output, std::vector<std::string> *error_output) {
     Pipe pipe_output, pipe_error;
+    std::shared_ptr<Pipe> pipe_exec;
     std::shared_ptr<Pipe> pipe_input;
     int fd_input = -1;
     std::string preload_library;
     std::string program;
     
     if (is_absolute(command->program)) {
-        if (file_exists(program)) {
+        if (file_exists(command->program)) {
             program = command->program;
         }
     }
     else {
         for (const auto &dir : command->path) {
             auto file = dir + "/" + command->program;
-            if (file_exists(file)) {
+            if (command->file_index != NULL ? command->file_index->file_exists(dir, command->program) : file_exists(file)) {
                 program = file;
                 break;
             }
@@ -223,18 +709,18 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
     }
     
     if (!command->preload_library.empty()) {
-        char *cwd_c = getcwd(NULL, 0);
-        if (cwd_c == NULL) {
-            throw Exception("can't get current directory", true);
-        }
-        auto dir = std::string(cwd_c) + "/..";
-        free(cwd_c);
-
         auto preload_directory = OS::dirname(command->preload_library);
         auto preload_name = OS::basename(command->preload_library);
-        
-        if (preload_directory != ".") {
-            dir += "/" + preload_directory;
+        std::string dir;
+
+        if (OS::is_absolute(preload_directory)) {
+            dir = preload_directory;
+        }
+        else {
+            dir = OS::current_directory() + "/..";
+            if (preload_directory != ".") {
+                dir += "/" + preload_directory;
+            }
         }
         preload_library = dir + "/.libs/" + preload_name;
         if (!OS::file_exists(preload_library)) {
@@ -245,7 +731,15 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
         }
     }
 
-    if (command->input != NULL) {
+    if (command->statistics != NULL) {
+        // closed by exec, so we know when the program starts
+        pipe_exec = std::make_shared<Pipe>();
+        if (fcntl(pipe_exec->write_fd, F_SETFD, FD_CLOEXEC) < 0) {
+            throw Exception("can't set close-on-exec flag", true);
+        }
+    }
+
+    if (command->input != NULL || command->input_data != NULL) {
         pipe_input = std::make_shared<Pipe>();
     }
     else if (!command->input_file.empty()) {
@@ -254,6 +748,20 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
         }
     }
     
+    std::shared_ptr<Cgroup> cgroup;
+    if (command->isolate) {
+        cgroup = Cgroup::create();
+    }
+    if (command->memory_max > 0 || command->cpu_max > 0) {
+        if (!cgroup) {
+            throw Exception("can't limit resources: control groups not available");
+        }
+        cgroup->set_limits(command->memory_max, command->cpu_max);
+    }
+
+    // Writing to the program's standard input after it closed it must not kill us.
+    signal(SIGPIPE, SIG_IGN);
+
     pid_t pid = fork();
     
     switch (pid) {
@@ -261,6 +769,11 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
 	throw Exception("can't fork", true);
 
     case 0: { // child
+        // Ignored signals stay ignored across exec.
+        signal(SIGPIPE, SIG_DFL);
+        if (pipe_exec) {
+            pipe_exec->close_read();
+        }
         if (pipe_input) {
             pipe_input->close_write();
         }
@@ -315,6 +828,53 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
 	argv[index++] = NULL;
         
         // TODO: set limits
+        if (command->file_size_max > 0) {
+            struct rlimit limit;
+            limit.rlim_cur = limit.rlim_max = static_cast<rlim_t>(command->file_size_max);
+            if (setrlimit(RLIMIT_FSIZE, &limit) < 0) {
+                std::cerr << "can't limit file size: " << strerror(errno) << "\n";
+                exit(17);
+            }
+        }
+
+        if (cgroup) {
+            if (::write(cgroup->procs_fd, "0", 1) < 0) {
+                std::cerr << "can't move into cgroup: " << strerror(errno) << "\n";
+                exit(17);
+            }
+            cgroup->close_procs();
+        }
+
+        if (!command->cpu_set.empty()) {
+#ifdef HAVE_SCHED_SETAFFINITY
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (auto cpu : command->cpu_set) {
+                CPU_SET(cpu, &cpus);
+            }
+            if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+                std::cerr << "can't set CPU affinity: " << strerror(errno) << "\n";
+                exit(17);
+            }
+#endif
+        }
+        if (command->batch_scheduling) {
+#ifdef SCHED_BATCH
+            struct sched_param param;
+            param.sched_priority = 0;
+            if (sched_setscheduler(0, SCHED_BATCH, &param) < 0) {
+                std::cerr << "can't set batch scheduling: " << strerror(errno) << "\n";
+                exit(17);
+            }
+#endif
+        }
+        if (command->nice != 0) {
+            errno = 0;
+            if (nice(command->nice) == -1 && errno != 0) {
+                std::cerr << "can't change scheduling priority: " << strerror(errno) << "\n";
+                exit(17);
+            }
+        }
         
         if (!preload_library.empty()) {
             setenv("LD_PRELOAD", preload_library.c_str(), 1);
@@ -326,6 +886,9 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
     }
 
     default: { // parent
+        if (cgroup) {
+            cgroup->close_procs();
+        }
         if (pipe_input) {
             pipe_input->close_read();
         }
@@ -335,6 +898,18 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
 	pipe_output.close_write();
 	pipe_error.close_write();
 
+        if (pipe_exec) {
+            char c;
+            pipe_exec->close_write();
+            while (::read(pipe_exec->read_fd, &c, 1) < 0 && errno == EINTR) {
+            }
+            pipe_exec->close_read();
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed = [start]() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+
         std::shared_ptr<Buffer> buffer_input;
 	auto buffer_output = Buffer(BUFFER_SIZE);
 	auto buffer_error = Buffer(BUFFER_SIZE);
@@ -347,12 +922,73 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
 	nfds_t nfds = 2;
 
         if (pipe_input) {
-            buffer_input = std::make_shared<Buffer>(*command->input);
+            if (command->input != NULL) {
+                buffer_input = std::make_shared<Buffer>(*command->input);
+            }
+            else {
+                buffer_input = std::make_shared<Buffer>(command->input_data);
+            }
+            // Don't block while the program is waiting for us to read its output.
+            fcntl(pipe_input->write_fd, F_SETFL, fcntl(pipe_input->write_fd, F_GETFL) | O_NONBLOCK);
             fds[nfds++].fd = pipe_input->write_fd;
         }
 
+        auto sampling = command->statistics != NULL && command->sample_interval > 0;
+        double next_sample = 0;
+        auto sampling_disk_usage = command->statistics != NULL && !command->disk_usage_directories.empty();
+        double next_disk_usage_sample = 0;
+        auto exited = false;
+
 	while (nfds > 0) {
-	    auto ret = poll(fds, nfds, -1); // TODO: timeout
+            auto timeout = -1; // TODO: timeout
+            if (sampling) {
+                auto now = elapsed();
+                if (now >= next_sample) {
+                    command->statistics->samples.push_back(sample_processes(pid, now));
+                    next_sample = now + command->sample_interval;
+                }
+                timeout = static_cast<int>((next_sample - now) * 1000) + 1;
+            }
+            if (sampling_disk_usage) {
+                auto now = elapsed();
+                if (now >= next_disk_usage_sample) {
+                    auto usage = OS::get_disk_usage(command->disk_usage_directories, command->disk_usage_excluded);
+                    auto &peak = command->statistics->disk_usage;
+                    peak.bytes = std::max(peak.bytes, usage.bytes);
+                    peak.inodes = std::max(peak.inodes, usage.inodes);
+                    if (command->disk_usage_max > 0 && usage.bytes > command->disk_usage_max) {
+                        // Stop it before it fills the disk.
+                        command->statistics->disk_usage_exceeded = true;
+                        if (cgroup) {
+                            cgroup->kill();
+                        }
+                        else {
+                            ::kill(pid, SIGKILL);
+                        }
+                        sampling_disk_usage = false;
+                    }
+                    // Don't spend more than a tenth of the time walking large directories.
+                    next_disk_usage_sample = now + std::max(DISK_USAGE_INTERVAL, 10 * (elapsed() - now));
+                }
+                if (sampling_disk_usage) {
+                    auto disk_timeout = static_cast<int>((next_disk_usage_sample - now) * 1000) + 1;
+                    timeout = timeout < 0 ? disk_timeout : std::min(timeout, disk_timeout);
+                }
+            }
+            if (cgroup && !exited) {
+                // Descendants may keep the output pipes open after the program exits, kill them.
+                siginfo_t info;
+                info.si_pid = 0;
+                if (waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid) {
+                    exited = true;
+                    cgroup->kill();
+                }
+                else {
+                    timeout = timeout < 0 ? 100 : std::min(timeout, 100);
+                }
+            }
+
+	    auto ret = poll(fds, nfds, timeout);
 	    if (ret < 0) {
 		throw Exception("poll failed", true);
 	    }
@@ -364,18 +1000,26 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
 	    for (nfds_t i = 0; i < nfds; i++) {
                 if (fds[i].revents & POLLIN) {
                     if (fds[i].fd == pipe_output.read_fd) {
-                        buffer_output.read(pipe_output.read_fd);
+                        auto n = buffer_output.read(pipe_output.read_fd);
+                        if (command->statistics != NULL) {
+                            record_transfer(&command->statistics->output, n, elapsed());
+                        }
                     }
                     if (fds[i].fd == pipe_error.read_fd) {
-                        buffer_error.read(pipe_error.read_fd);
+                        auto n = buffer_error.read(pipe_error.read_fd);
+                        if (command->statistics != NULL) {
+                            record_transfer(&command->statistics->error_output, n, elapsed());
+                        }
                     }
                 }
+		if (pipe_input && fds[i].fd == pipe_input->write_fd && (fds[i].revents & (POLLERR | POLLHUP))) {
+                    // The program closed its standard input, the rest is not needed.
+                    pipe_input->close_write();
+                    nfds = pollfds_remove(fds, nfds, i);
+                    --i;
+                    continue;
+                }
 		if (fds[i].revents & POLLHUP) {
-		    if (pipe_input && fds[i].fd == pipe_input->write_fd) {
-			if (!buffer_input->end()) {
-			    // TODO: stdin closed before we wrote all data
-			}
-		    }
 		    // TODO: handle HUP
 		    nfds = pollfds_remove(fds, nfds, i);
 		    --i;
@@ -383,7 +1027,12 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
 		}
 		if (fds[i].revents & POLLOUT) {
 		    if (pipe_input && fds[i].fd == pipe_input->write_fd) {
-			if (buffer_input->write(pipe_input->write_fd)) {
+                        auto position = buffer_input->position();
+                        auto done = buffer_input->write(pipe_input->write_fd);
+                        if (command->statistics != NULL) {
+                            record_transfer(&command->statistics->input, buffer_input->position() - position, elapsed());
+                        }
+			if (done) {
                             pipe_input->close_write();
 			    nfds = pollfds_remove(fds, nfds, i);
 			    --i;
@@ -394,11 +1043,34 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
 	    }
 	}
 
+        if (sampling) {
+            // the program has not been reaped yet, so its final I/O counters are still available
+            command->statistics->samples.push_back(sample_processes(pid, elapsed()));
+        }
+
 	buffer_output.get_lines(output);
 	buffer_error.get_lines(error_output);
 
 	int status;
-	waitpid(pid, &status, 0);
+        struct rusage usage;
+	wait4(pid, &status, 0, &usage);
+
+        if (command->statistics != NULL) {
+            command->statistics->run_time = elapsed();
+#ifdef __APPLE__
+            command->statistics->max_rss = static_cast<uint64_t>(usage.ru_maxrss);
+#else
+            command->statistics->max_rss = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+        }
+
+        if (cgroup) {
+            cgroup->kill();
+            if (command->statistics != NULL) {
+                cgroup->get_statistics(&command->statistics->group);
+            }
+            cgroup = NULL;
+        }
 
 	if (WIFEXITED(status)) {
 	    return std::to_string(WEXITSTATUS(status));
@@ -433,6 +1105,8 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
                 return "SIGTERM";
             case SIGTRAP:
                 return "SIGTRAP";
+            case SIGXFSZ:
+                return "SIGXFSZ";
                 
             default:
                 return "unknown signal " + std::to_string(WTERMSIG(status));
@@ -445,3 +1119,41 @@ std::string OS::run_command(const Command *command, std::vector<std::string> *ou
     }
     }
 }
+
+
+void OS::run_in_background(const std::function<void()> &function) {
+    auto pid = fork();
+    if (pid < 0) {
+        function();
+        return;
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    // Fork again so we are not our parent's child and it doesn't have to reap us.
+    setsid();
+    if (fork() != 0) {
+        _exit(0);
+    }
+
+    // Whoever is waiting for our output (e.g. ctest) must not wait for us.
+    auto fd = open("/dev/null", O_RDWR);
+    if (fd >= 0) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+    }
+    auto max_fd = std::min(sysconf(_SC_OPEN_MAX), 4096L);
+    for (auto i = STDERR_FILENO + 1; i < max_fd; i++) {
+        close(i);
+    }
+
+    try {
+        function();
+    }
+    catch (...) {
+    }
+    _exit(0);
+}
@@ -33,19 +33,51 @@
 
 #include "OS.h"
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
 
+#include "config.h"
 #include "Exception.h"
 
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_MOUNT_H
+#include <sys/mount.h>
+#endif
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_SYS_VFS_H
+#include <sys/vfs.h>
+#endif
+
+#if defined(CPU_SETSIZE)
+const int OS::max_cpus = CPU_SETSIZE;
+#else
+const int OS::max_cpus = 1024;
+#endif
+
 const std::string OS::path_separator = "/";
 
 const std::unordered_map<std::string, std::string> OS::standard_environment = {
@@ -55,6 +87,38 @@ const std::unordered_map<std::string, std::string> OS::standard_environment = {
 };
 
 
+OS::MappedFile::MappedFile(const std::string &name) : data(NULL), size(0) {
+    auto fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw Exception("cannot open '" + name + "'", true);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw Exception("cannot stat '" + name + "'", true);
+    }
+
+    if (st.st_size > 0) {
+        auto mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw Exception("cannot map '" + name + "'", true);
+        }
+        data = static_cast<const uint8_t *>(mapping);
+        size = st.st_size;
+    }
+    close(fd);
+}
+
+
+OS::MappedFile::~MappedFile() {
+    if (data != NULL) {
+        munmap(const_cast<uint8_t *>(data), size);
+    }
+}
+
+
 std::string OS::append_path_component(const std::string &directory, const std::string &name) {
     if (directory.empty() || directory == ".") {
         return name;
@@ -65,6 +129,31 @@ std::string OS::append_path_component(const std::string &directory, const std::s
 }
 
 
+bool OS::can_share_data_blocks(const std::string &directory) {
+#ifdef FICLONE
+    auto name = append_path_component(directory.empty() ? "." : directory, ".nihtest-clone." + std::to_string(getpid()));
+    auto from_fd = open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (from_fd < 0) {
+        return false;
+    }
+    unlink(name.c_str());
+    auto to_fd = open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (to_fd < 0) {
+        close(from_fd);
+        return false;
+    }
+    unlink(name.c_str());
+
+    auto ok = write(from_fd, "x", 1) == 1 && ioctl(to_fd, FICLONE, from_fd) == 0;
+    close(from_fd);
+    close(to_fd);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+
 void OS::change_directory(const std::string &directory) {
     if (chdir(directory.c_str()) < 0) {
 	throw Exception("can't change into directory '" + directory + "'", true);
@@ -72,6 +161,409 @@ void OS::change_directory(const std::string &directory) {
 }
 
 
+std::string OS::current_directory() {
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        throw Exception("can't get current directory", true);
+    }
+    auto directory = std::string(cwd);
+    free(cwd);
+    return directory;
+}
+
+
+// Find offset of first difference in `size` bytes at `left` and `right`, returns false if they are identical.
+static bool find_difference(const char *left, const char *right, size_t size, uint64_t *offset) {
+    // memcmp is vectorized, only search byte by byte in the block that differs
+    const size_t block_size = 64 * 1024;
+
+    for (size_t start = 0; start < size; start += block_size) {
+        auto length = std::min(block_size, size - start);
+        if (memcmp(left + start, right + start, length) != 0) {
+            *offset = start + (std::mismatch(left + start, left + start + length, right + start).first - (left + start));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Like find_difference(), but split into chunks compared concurrently if `size` is large and we have multiple CPUs.
+static bool find_difference_parallel(const char *left, const char *right, size_t size, uint64_t *offset) {
+    const size_t chunk_size = 16 * 1024 * 1024;
+    const size_t parallel_threshold = 4 * chunk_size;
+
+    auto chunks = (size + chunk_size - 1) / chunk_size;
+    auto workers = std::min(static_cast<size_t>(std::thread::hardware_concurrency()), chunks);
+    if (size < parallel_threshold || workers < 2) {
+        return find_difference(left, right, size, offset);
+    }
+
+    // Chunks are handed out in order, so once a difference is found, only chunks before it still need to be compared.
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<uint64_t> first_difference(UINT64_MAX);
+
+    auto worker = [&]() {
+        size_t chunk;
+        while ((chunk = next_chunk++) < chunks) {
+            auto start = chunk * chunk_size;
+            if (start >= first_difference) {
+                return;
+            }
+            uint64_t chunk_offset;
+            if (find_difference(left + start, right + start, std::min(chunk_size, size - start), &chunk_offset)) {
+                auto difference = start + chunk_offset;
+                auto current = first_difference.load();
+                while (difference < current && !first_difference.compare_exchange_weak(current, difference)) {
+                }
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (first_difference == UINT64_MAX) {
+        return false;
+    }
+    *offset = first_difference;
+    return true;
+}
+
+
+// Region of a file containing data.
+struct Extent {
+    Extent(uint64_t start_, uint64_t end_) : start(start_), end(end_) { }
+
+    uint64_t start;
+    uint64_t end;
+
+    bool operator<(const Extent &other) const { return start < other.start; }
+};
+
+
+// Check whether file has holes.
+static bool is_sparse(const struct stat &st) {
+    // st_blocks is in units of 512 bytes on all supported systems.
+    return static_cast<uint64_t>(st.st_blocks) * 512 < static_cast<uint64_t>(st.st_size);
+}
+
+
+// Append regions of `fd` containing data to `extents`, returns false if the system can't tell.
+static bool get_data_extents(int fd, uint64_t size, std::vector<Extent> *extents) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    uint64_t position = 0;
+    while (position < size) {
+        auto data = lseek(fd, static_cast<off_t>(position), SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                // only a hole is left
+                break;
+            }
+            return false;
+        }
+        auto hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            return false;
+        }
+        extents->push_back(Extent(static_cast<uint64_t>(data), std::min(static_cast<uint64_t>(hole), size)));
+        position = static_cast<uint64_t>(hole);
+    }
+    lseek(fd, 0, SEEK_SET);
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+// Sort `extents` and merge overlapping ones.
+static void merge_extents(std::vector<Extent> *extents) {
+    std::sort(extents->begin(), extents->end());
+
+    std::vector<Extent> merged;
+    for (const auto &extent : *extents) {
+        if (!merged.empty() && extent.start <= merged.back().end) {
+            merged.back().end = std::max(merged.back().end, extent.end);
+        }
+        else {
+            merged.push_back(extent);
+        }
+    }
+    *extents = merged;
+}
+
+
+// Compare `size` bytes of `left_fd` and `right_fd` starting at `start`, returns false if they are identical.
+static bool find_difference(int left_fd, int right_fd, uint64_t start, uint64_t size, uint64_t *offset, const std::string &left, const std::string &right) {
+    // Mapping has a fixed cost, but avoids copying data for large files.
+    const uint64_t mmap_threshold = 1024 * 1024;
+    
+    // Mappings have to start at a page boundary.
+    auto map_start = start - start % static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    auto map_size = size + (start - map_start);
+    if (size >= mmap_threshold && map_size <= SIZE_MAX) {
+        auto left_map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, left_fd, static_cast<off_t>(map_start));
+        auto right_map = left_map == MAP_FAILED ? MAP_FAILED : mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, right_fd, static_cast<off_t>(map_start));
+        if (right_map != MAP_FAILED) {
+            madvise(left_map, map_size, MADV_SEQUENTIAL);
+            madvise(right_map, map_size, MADV_SEQUENTIAL);
+            auto left_data = static_cast<const char *>(left_map) + (start - map_start);
+            auto right_data = static_cast<const char *>(right_map) + (start - map_start);
+            auto differ = find_difference_parallel(left_data, right_data, size, offset);
+            munmap(left_map, map_size);
+            munmap(right_map, map_size);
+            if (differ) {
+                *offset += start;
+            }
+            return differ;
+        }
+        if (left_map != MAP_FAILED) {
+            munmap(left_map, map_size);
+        }
+        // fall back to reading
+    }
+
+    const size_t buffer_size = 256 * 1024;
+    std::vector<char> left_buffer(std::min(static_cast<uint64_t>(buffer_size), size));
+    std::vector<char> right_buffer(left_buffer.size());
+
+    for (uint64_t position = start; position < start + size; ) {
+        auto length = static_cast<size_t>(std::min(static_cast<uint64_t>(buffer_size), start + size - position));
+        auto left_length = pread(left_fd, left_buffer.data(), length, position);
+        if (left_length < 0) {
+            throw Exception("error reading from '" + left + "'", true);
+        }
+        auto right_length = pread(right_fd, right_buffer.data(), length, position);
+        if (right_length < 0) {
+            throw Exception("error reading from '" + right + "'", true);
+        }
+        if (left_length == 0 || left_length != right_length) {
+            // one of the files was truncated while we compare
+            throw Exception("unexpected end of file in '" + (left_length == 0 ? left : right) + "'");
+        }
+        if (find_difference(left_buffer.data(), right_buffer.data(), left_length, offset)) {
+            *offset += position;
+            return true;
+        }
+        position += left_length;
+    }
+
+    return false;
+}
+
+
+bool OS::compare_files(const std::string &left, const std::string &right, std::string *difference) {
+    auto left_fd = open(left.c_str(), O_RDONLY | O_CLOEXEC);
+    if (left_fd < 0) {
+        throw Exception("cannot open '" + left + "'", true);
+    }
+    auto right_fd = open(right.c_str(), O_RDONLY | O_CLOEXEC);
+    if (right_fd < 0) {
+        close(left_fd);
+        throw Exception("cannot open '" + right + "'", true);
+    }
+
+    try {
+        struct stat left_st, right_st;
+        if (fstat(left_fd, &left_st) < 0) {
+            throw Exception("cannot stat '" + left + "'", true);
+        }
+        if (fstat(right_fd, &right_st) < 0) {
+            throw Exception("cannot stat '" + right + "'", true);
+        }
+
+        auto same = true;
+        if (left_st.st_size != right_st.st_size) {
+            if (difference != NULL) {
+                *difference = "sizes differ (" + std::to_string(left_st.st_size) + " and " + std::to_string(right_st.st_size) + " bytes)";
+            }
+            same = false;
+        }
+        else if (left_st.st_dev != right_st.st_dev || left_st.st_ino != right_st.st_ino) {
+            std::vector<Extent> extents;
+            // Holes read as zeros, so only regions that contain data in at least one file need to be compared.
+            if (!(is_sparse(left_st) || is_sparse(right_st)) || !get_data_extents(left_fd, left_st.st_size, &extents) || !get_data_extents(right_fd, right_st.st_size, &extents)) {
+                extents.clear();
+                extents.push_back(Extent(0, left_st.st_size));
+            }
+            else {
+                merge_extents(&extents);
+            }
+
+            for (const auto &extent : extents) {
+                uint64_t offset;
+                if (find_difference(left_fd, right_fd, extent.start, extent.end - extent.start, &offset, left, right)) {
+                    if (difference != NULL) {
+                        *difference = "first difference at byte " + std::to_string(offset);
+                    }
+                    same = false;
+                    break;
+                }
+            }
+        }
+
+        close(left_fd);
+        close(right_fd);
+        return same;
+    }
+    catch (Exception &e) {
+        close(left_fd);
+        close(right_fd);
+        throw;
+    }
+}
+
+
+// Copy `length` bytes from the current position of `from_fd` to the current position of `to_fd`, or up to the end of `from_fd` if `length` is UINT64_MAX, letting the kernel do the work if possible.
+static void copy_range(int from_fd, int to_fd, uint64_t length, const std::string &from, const std::string &to) {
+    // Fall back to the next method only if the kernel or file system doesn't support this one.
+    auto unsupported = [](int error) {
+        return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP;
+    };
+    const uint64_t chunk_size = 1 << 30;
+    ssize_t n;
+
+    auto remaining = length;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    off_t copied = 0;
+    while (remaining > 0 && (n = copy_file_range(from_fd, NULL, to_fd, NULL, static_cast<size_t>(std::min(chunk_size, remaining)), 0)) > 0) {
+        copied += n;
+        remaining -= n;
+    }
+    if (remaining == 0 || n == 0) {
+        return;
+    }
+    if (copied > 0 || !unsupported(errno)) {
+        throw Exception("error copying '" + from + "' to '" + to + "'", true);
+    }
+#endif
+
+#ifdef HAVE_SENDFILE
+    off_t sent = 0;
+    while (remaining > 0 && (n = sendfile(to_fd, from_fd, NULL, static_cast<size_t>(std::min(chunk_size, remaining)))) > 0) {
+        sent += n;
+        remaining -= n;
+    }
+    if (remaining == 0 || n == 0) {
+        return;
+    }
+    if (sent > 0 || !unsupported(errno)) {
+        throw Exception("error copying '" + from + "' to '" + to + "'", true);
+    }
+#endif
+
+    char buf[64 * 1024];
+    while (remaining > 0 && (n = read(from_fd, buf, static_cast<size_t>(std::min(static_cast<uint64_t>(sizeof(buf)), remaining)))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw Exception("error reading from '" + from + "'", true);
+        }
+        auto data = buf;
+        while (n > 0) {
+            auto written = write(to_fd, data, n);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw Exception("error writing to '" + to + "'", true);
+            }
+            data += written;
+            n -= written;
+        }
+        remaining -= (data - buf);
+    }
+}
+
+
+// Copy contents of `from_fd` (with status `st`) to `to_fd`.
+static void copy_data(int from_fd, int to_fd, const struct stat &st, const std::string &from, const std::string &to) {
+#ifdef FICLONE
+    // share data blocks on file systems that support it (btrfs, XFS)
+    if (ioctl(to_fd, FICLONE, from_fd) == 0) {
+        return;
+    }
+#endif
+
+    std::vector<Extent> extents;
+    if (is_sparse(st) && get_data_extents(from_fd, st.st_size, &extents)) {
+        // Copy only data, leaving holes.
+        for (const auto &extent : extents) {
+            if (lseek(from_fd, static_cast<off_t>(extent.start), SEEK_SET) < 0) {
+                throw Exception("cannot seek in '" + from + "'", true);
+            }
+            if (lseek(to_fd, static_cast<off_t>(extent.start), SEEK_SET) < 0) {
+                throw Exception("cannot seek in '" + to + "'", true);
+            }
+            copy_range(from_fd, to_fd, extent.end - extent.start, from, to);
+        }
+        // Also creates hole at end of file.
+        if (ftruncate(to_fd, st.st_size) < 0) {
+            throw Exception("error writing to '" + to + "'", true);
+        }
+        return;
+    }
+
+    copy_range(from_fd, to_fd, UINT64_MAX, from, to);
+}
+
+
+void OS::copy_file(const std::string &from, const std::string &to) {
+    auto from_fd = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (from_fd < 0) {
+        throw Exception("cannot open '" + from + "'", true);
+    }
+
+    struct stat st;
+    if (fstat(from_fd, &st) < 0) {
+        close(from_fd);
+        throw Exception("cannot stat '" + from + "'", true);
+    }
+
+    // The copy belongs to the test, so it is writable even if `from` is not, e.g. in a read-only source tree.
+    auto mode = (st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO)) | S_IWUSR;
+    int to_fd;
+    try {
+        OS::ensure_directory(OS::dirname(to));
+        if ((to_fd = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode)) < 0) {
+            throw Exception("cannot create '" + to + "'", true);
+        }
+    }
+    catch (Exception &e) {
+        close(from_fd);
+        throw;
+    }
+
+    try {
+        copy_data(from_fd, to_fd, st, from, to);
+        if (fchmod(to_fd, mode) < 0) {
+            throw Exception("cannot set mode of '" + to + "'", true);
+        }
+    }
+    catch (Exception &e) {
+        close(from_fd);
+        close(to_fd);
+        throw;
+    }
+
+    close(from_fd);
+    if (close(to_fd) < 0) {
+        throw Exception("error writing to '" + to + "'", true);
+    }
+}
+
+
 void OS::create_directory(const std::string &directory) {
     if (mkdir(directory.c_str(), 0777) < 0) {
         throw Exception("can't create directory '" + directory + "'", true);
@@ -79,6 +571,75 @@ void OS::create_directory(const std::string &directory) {
 }
 
 
+struct Process {
+    pid_t pid;
+    std::string name;
+    int cpu;
+};
+
+
+static std::string read_line(const std::string &file_name) {
+    auto file = std::ifstream(file_name);
+    std::string line;
+
+    std::getline(file, line);
+    return line;
+}
+
+
+// Get processes other than us that are currently running (not sleeping or waiting).
+static std::vector<Process> running_processes() {
+    std::vector<Process> processes;
+    auto self = getpid();
+
+    DIR *dir = opendir("/proc");
+    if (dir == NULL) {
+        return processes;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+            continue;
+        }
+        auto pid = static_cast<pid_t>(atoi(entry->d_name));
+        if (pid == self) {
+            continue;
+        }
+
+        // pid (name) state ppid ... processor is field 39
+        auto line = read_line(std::string("/proc/") + entry->d_name + "/stat");
+        auto open = line.find('(');
+        auto close = line.rfind(')');
+        if (open == std::string::npos || close == std::string::npos || close < open) {
+            continue;
+        }
+        auto stream = std::istringstream(line.substr(close + 1));
+        std::vector<std::string> fields;
+        std::string field;
+        while (stream >> field) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 37 || fields[0] != "R") {
+            continue;
+        }
+        processes.push_back(Process{pid, line.substr(open + 1, close - open - 1), atoi(fields[36].c_str())});
+    }
+    closedir(dir);
+
+    return processes;
+}
+
+
+static std::vector<int> cpu_siblings(int cpu) {
+    auto siblings = OS::parse_cpu_list(read_line("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list"));
+    if (siblings.empty()) {
+        siblings.push_back(cpu);
+    }
+    return siblings;
+}
+
+
 bool OS::file_exists(const std::string &file_name) {
     struct stat st;
     
@@ -90,6 +651,20 @@ bool OS::file_exists(const std::string &file_name) {
 }
 
 
+bool OS::is_writable(const std::string &name) {
+    return access(name.c_str(), W_OK) == 0;
+}
+
+
+void OS::make_read_only(const std::string &name) {
+    struct stat st;
+
+    if (stat(name.c_str(), &st) < 0 || chmod(name.c_str(), st.st_mode & ~(S_IWUSR | S_IWGRP | S_IWOTH) & (S_IRWXU | S_IRWXG | S_IRWXO)) < 0) {
+        throw Exception("can't make '" + name + "' read-only", true);
+    }
+}
+
+
 bool OS::directory_exists(const std::string &name) {
     struct stat st;
     
@@ -101,11 +676,115 @@ bool OS::directory_exists(const std::string &name) {
 }
 
 
+// The program may be changing the directory tree, so entries vanishing while we look are skipped, not errors.
+static void get_disk_usage_recurse(int fd, OS::DiskUsage *usage, std::unordered_set<ino_t> *linked, const std::set<std::pair<uint64_t, uint64_t>> &excluded) {
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode) && st.st_nlink > 1 && !linked->insert(st.st_ino).second) {
+            continue;
+        }
+        if (!excluded.empty() && excluded.find(std::make_pair(static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino))) != excluded.end()) {
+            continue;
+        }
+        usage->inodes += 1;
+        usage->bytes += static_cast<uint64_t>(st.st_blocks) * 512;
+
+        if (S_ISDIR(st.st_mode)) {
+            auto subdirectory = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (subdirectory >= 0) {
+                get_disk_usage_recurse(subdirectory, usage, linked, excluded);
+            }
+        }
+    }
+
+    closedir(dir);
+}
+
+
+OS::DiskUsage OS::get_disk_usage(const std::string &directory, const std::vector<FileInfo> &excluded) {
+    DiskUsage usage;
+    std::unordered_set<ino_t> linked;
+    std::set<std::pair<uint64_t, uint64_t>> excluded_files;
+    for (const auto &file : excluded) {
+        excluded_files.insert(std::make_pair(file.device, file.inode));
+    }
+
+    auto fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw Exception("can't open directory '" + directory + "'", true);
+    }
+    get_disk_usage_recurse(fd, &usage, &linked, excluded_files);
+
+    return usage;
+}
+
+
+OS::FileInfo OS::get_file_info(const std::string &name) {
+    struct stat st;
+
+    if (stat(name.c_str(), &st) < 0) {
+        throw Exception("can't stat '" + name + "'", true);
+    }
+
+    FileInfo info;
+    info.device = st.st_dev;
+    info.inode = st.st_ino;
+    info.size = st.st_size;
+    info.modification_time = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    info.change_time = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+    return info;
+}
+
+
+int64_t OS::get_file_system_time(const std::string &directory) {
+    // File systems use a clock that may lag behind the system clock, so let it set a time.
+    if (utimensat(AT_FDCWD, directory.c_str(), NULL, 0) < 0) {
+        return 0;
+    }
+    return get_file_info(directory).modification_time;
+}
+
+
 std::string OS::get_error_string() {
     return strerror(errno);
 }
 
 
+OS::SystemNoise OS::get_system_noise() {
+    SystemNoise noise;
+
+    double load[3];
+    if (getloadavg(load, 3) == 3) {
+        std::ostringstream stream;
+        stream.precision(2);
+        stream << std::fixed << load[0] << " " << load[1] << " " << load[2];
+        noise.load_average = stream.str();
+    }
+
+    noise.governor = read_line("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor");
+
+    for (const auto &process : running_processes()) {
+        noise.busy_processes.push_back(process.name + " (" + std::to_string(process.pid) + ")");
+    }
+
+    return noise;
+}
+
+
 bool OS::is_absolute(const std::string &file_name) {
     if (file_name.empty()) {
         return false;
@@ -114,51 +793,159 @@ bool OS::is_absolute(const std::string &file_name) {
 }
 
 
-static bool is_directory(const std::string &directory) {
-    struct stat st;
-    
-    if (stat(directory.c_str(), &st) < 0) {
-        throw Exception("can't stat '" + directory + "'", true);
+void OS::link_file(const std::string &from, const std::string &to) {
+    ensure_directory(dirname(to));
+
+    // fails across file systems or if protected_hardlinks forbids it
+    if (link(from.c_str(), to.c_str()) == 0) {
+        return;
+    }
+
+    auto target = is_absolute(from) ? from : append_path_component(current_directory(), from);
+    if (symlink(target.c_str(), to.c_str()) < 0) {
+        throw Exception("can't link '" + from + "' to '" + to + "'", true);
     }
-    return S_ISDIR(st.st_mode);
 }
 
 
-static void list_files_recurse(const std::string &directory, std::vector<std::string> *all_files) {
+std::vector<std::string> OS::list_directory(const std::string &directory) {
+    std::vector<std::string> names;
+
+    for (const auto &entry : list_directory_entries(directory)) {
+        names.push_back(entry.name);
+    }
+
+    return names;
+}
+
+
+std::vector<OS::DirectoryEntry> OS::list_directory_entries(const std::string &directory) {
+    std::vector<DirectoryEntry> entries;
+
     DIR *dir = opendir(directory.c_str());
     if (dir == NULL) {
+        if (errno == ENOENT) {
+            return entries;
+        }
         throw Exception("can't list directory '" + directory + "'", true);
     }
-    
-    std::vector<std::string> files;
-    
+
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
-        files.push_back(entry->d_name);
+        FileType type;
+        switch (entry->d_type) {
+        case DT_REG:
+            type = FILE_TYPE_REGULAR;
+            break;
+        case DT_DIR:
+            type = FILE_TYPE_DIRECTORY;
+            break;
+        case DT_UNKNOWN:
+        case DT_LNK:
+            type = FILE_TYPE_UNKNOWN;
+            break;
+        default:
+            type = FILE_TYPE_OTHER;
+            break;
+        }
+        entries.push_back(DirectoryEntry(entry->d_name, type));
     }
     closedir(dir);
-    
-    std::sort(files.begin(), files.end());
-    
-    for (const auto &file : files) {
-        auto name = OS::append_path_component(directory, file);
-        if (is_directory(name)) {
-            list_files_recurse(name, all_files);
+
+    return entries;
+}
+
+
+// Append files in directory `fd` and its subdirectories to `all_files`, prefixing them with `path`. Closes `fd`.
+static void list_files_recurse(int fd, std::string *path, std::vector<std::string> *all_files) {
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        throw Exception("can't list directory '" + (path->empty() ? "." : *path) + "'", true);
+    }
+
+    try {
+        struct Entry {
+            size_t offset;
+            bool is_directory;
+        };
+        // names of all entries, each terminated by NUL, to avoid allocating a string per entry
+        std::string names;
+        std::vector<Entry> entries;
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            bool is_directory;
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                // symbolic links to directories are followed
+                struct stat st;
+                if (fstatat(dirfd(dir), entry->d_name, &st, 0) < 0) {
+                    throw Exception("can't stat '" + OS::append_path_component(*path, entry->d_name) + "'", true);
+                }
+                is_directory = S_ISDIR(st.st_mode);
+            }
+            else {
+                is_directory = entry->d_type == DT_DIR;
+            }
+
+            entries.push_back(Entry{names.size(), is_directory});
+            names.append(entry->d_name);
+            names.push_back('\0');
         }
-        else {
-            all_files->push_back(name);
+
+        std::sort(entries.begin(), entries.end(), [&names](const Entry &a, const Entry &b) {
+            return strcmp(names.data() + a.offset, names.data() + b.offset) < 0;
+        });
+
+        auto length = path->size();
+        for (const auto &entry : entries) {
+            auto name = names.data() + entry.offset;
+
+            if (length > 0) {
+                path->append(OS::path_separator);
+            }
+            path->append(name);
+
+            if (entry.is_directory) {
+                auto subdirectory = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (subdirectory < 0) {
+                    throw Exception("can't list directory '" + *path + "'", true);
+                }
+                list_files_recurse(subdirectory, path, all_files);
+            }
+            else {
+                all_files->push_back(*path);
+            }
+
+            path->resize(length);
         }
     }
+    catch (Exception &e) {
+        closedir(dir);
+        throw;
+    }
+
+    closedir(dir);
 }
 
 
 std::vector<std::string> OS::list_files(const std::string &directory) {
     std::vector<std::string> files;
 
-    list_files_recurse(directory, &files);
+    auto fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw Exception("can't list directory '" + directory + "'", true);
+    }
+
+    std::string path = directory == "." ? "" : directory;
+    list_files_recurse(fd, &path, &files);
     
     return files;
 }
@@ -177,12 +964,238 @@ std::string OS::make_temp_directory(const std::string &directory, const std::str
     return temp_directory;
 }
 
+std::string OS::memory_directory() {
+#if defined(HAVE_SYS_VFS_H)
+    // f_type of tmpfs, from <linux/magic.h>
+    const auto tmpfs_magic = 0x01021994;
+    struct statfs fs;
+
+    if (statfs("/dev/shm", &fs) < 0 || fs.f_type != tmpfs_magic || access("/dev/shm", W_OK | X_OK) < 0) {
+        return "";
+    }
+
+    auto directory = "/dev/shm/nihtest-" + std::to_string(getuid());
+    if (mkdir(directory.c_str(), 0700) < 0 && errno != EEXIST) {
+        throw Exception("can't create directory '" + directory + "'", true);
+    }
+
+    // /dev/shm is world writable, make sure nobody else planted it
+    struct stat st;
+    if (lstat(directory.c_str(), &st) < 0) {
+        throw Exception("can't stat '" + directory + "'", true);
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        throw Exception("'" + directory + "' is not a private directory");
+    }
+    return directory;
+#else
+    return "";
+#endif
+}
+
+
+bool OS::mount_private_memory_file_system(const std::string &directory) {
+#if defined(HAVE_UNSHARE) && defined(HAVE_SYS_MOUNT_H) && defined(CLONE_NEWUSER)
+    // The program inherits our namespaces; only use a user namespace, which changes its credentials, if we must.
+    if (unshare(CLONE_NEWNS) < 0) {
+        auto uid = getuid();
+        auto gid = getgid();
+
+        if (unshare(CLONE_NEWUSER | CLONE_NEWNS) < 0) {
+            return false;
+        }
+
+        // Map our own user and group, so files keep their owner.
+        auto write_file = [](const std::string &name, const std::string &content) {
+            auto file = std::ofstream(name);
+            file << content;
+            file.close();
+            return !file.fail();
+        };
+        write_file("/proc/self/setgroups", "deny");
+        if (!write_file("/proc/self/uid_map", std::to_string(uid) + " " + std::to_string(uid) + " 1") || !write_file("/proc/self/gid_map", std::to_string(gid) + " " + std::to_string(gid) + " 1")) {
+            throw Exception("can't set up user namespace", true);
+        }
+    }
+
+    if (mount("none", "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0 || mount("tmpfs", directory.c_str(), "tmpfs", MS_NOSUID | MS_NODEV, "mode=0700") < 0) {
+        throw Exception("can't mount RAM-backed file system on '" + directory + "'", true);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+bool OS::move_file(const std::string &from, const std::string &to) {
+#ifdef HAVE_RENAMEAT2
+    if (renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), RENAME_NOREPLACE) == 0) {
+        return true;
+    }
+    if (errno == ENOENT || errno == EEXIST) {
+        return false;
+    }
+    if (errno != EINVAL) {
+        throw Exception("can't rename '" + from + "' to '" + to + "'", true);
+    }
+    // file system doesn't support RENAME_NOREPLACE, fall back to check and rename
+#endif
+
+    struct stat st;
+    if (lstat(to.c_str(), &st) == 0) {
+        return false;
+    }
+    if (rename(from.c_str(), to.c_str()) < 0) {
+        if (errno == ENOENT) {
+            return false;
+        }
+        throw Exception("can't rename '" + from + "' to '" + to + "'", true);
+    }
+    return true;
+}
+
+
+// Remove all entries of directory `fd`, which is closed afterwards.
+static void remove_directory_contents(int fd, const std::string &directory) {
+    struct stat st;
+
+    // we need write and search permission to remove entries
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw Exception("can't stat '" + directory + "'", true);
+    }
+    if ((st.st_mode & S_IRWXU) != S_IRWXU && fchmod(fd, st.st_mode | S_IRWXU) < 0) {
+        close(fd);
+        throw Exception("can't change permissions of '" + directory + "'", true);
+    }
+
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        throw Exception("can't list directory '" + directory + "'", true);
+    }
+
+    try {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            auto is_directory = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN) {
+                if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                    throw Exception("can't stat '" + OS::append_path_component(directory, entry->d_name) + "'", true);
+                }
+                is_directory = S_ISDIR(st.st_mode);
+            }
+
+            if (is_directory) {
+                auto name = OS::append_path_component(directory, entry->d_name);
+                auto flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+                auto subdirectory = openat(dirfd(dir), entry->d_name, flags);
+                if (subdirectory < 0 && errno == EACCES && fchmodat(dirfd(dir), entry->d_name, S_IRWXU, 0) == 0) {
+                    subdirectory = openat(dirfd(dir), entry->d_name, flags);
+                }
+                if (subdirectory < 0) {
+                    throw Exception("can't open directory '" + name + "'", true);
+                }
+                remove_directory_contents(subdirectory, name);
+                if (unlinkat(dirfd(dir), entry->d_name, AT_REMOVEDIR) < 0) {
+                    throw Exception("can't remove directory '" + name + "'", true);
+                }
+            }
+            else if (unlinkat(dirfd(dir), entry->d_name, 0) < 0) {
+                throw Exception("can't remove '" + OS::append_path_component(directory, entry->d_name) + "'", true);
+            }
+        }
+    }
+    catch (Exception &e) {
+        closedir(dir);
+        throw;
+    }
+
+    closedir(dir);
+}
+
+
 void OS::remove_directory(const std::string &directory) {
-    // TODO: proper implementation
-    auto command = "rm -r " + directory;
-    system(command.c_str());
+    auto fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        throw Exception("can't open directory '" + directory + "'", true);
+    }
+
+    remove_directory_contents(fd, directory);
+
+    if (rmdir(directory.c_str()) < 0) {
+        throw Exception("can't remove directory '" + directory + "'", true);
+    }
 }
 
+std::vector<int> OS::select_benchmark_cpus() {
+    std::vector<int> cpus;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        throw Exception("can't get CPU affinity", true);
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    // Stay on the NUMA node we are running on.
+    auto current_cpu = sched_getcpu();
+    for (int node = 0; current_cpu >= 0; node++) {
+        auto directory = "/sys/devices/system/node/node" + std::to_string(node);
+        if (!directory_exists(directory)) {
+            break;
+        }
+        auto node_cpus = parse_cpu_list(read_line(directory + "/cpulist"));
+        if (std::find(node_cpus.begin(), node_cpus.end(), current_cpu) != node_cpus.end()) {
+            std::vector<int> local_cpus;
+            for (auto cpu : cpus) {
+                if (std::find(node_cpus.begin(), node_cpus.end(), cpu) != node_cpus.end()) {
+                    local_cpus.push_back(cpu);
+                }
+            }
+            cpus = local_cpus;
+            break;
+        }
+    }
+
+    // Avoid cores that other processes are running on, including their SMT siblings.
+    std::set<int> unavailable;
+    for (const auto &process : running_processes()) {
+        for (auto sibling : cpu_siblings(process.cpu)) {
+            unavailable.insert(sibling);
+        }
+    }
+
+    // Use only one hardware thread per core.
+    std::vector<int> selected;
+    for (auto cpu : cpus) {
+        if (unavailable.find(cpu) != unavailable.end()) {
+            continue;
+        }
+        selected.push_back(cpu);
+        for (auto sibling : cpu_siblings(cpu)) {
+            unavailable.insert(sibling);
+        }
+    }
+
+    if (!selected.empty()) {
+        cpus = selected;
+    }
+#endif
+
+    return cpus;
+}
+
+
 std::string OS::operating_system() {
     struct utsname name;
     
@@ -34,13 +34,19 @@
 
 #include "OS.h"
 
+#include <sys/stat.h>
 #include <direct.h>
 #include <windows.h>
 
 #include <algorithm>
+#include <fstream>
+#include <iterator>
 
 #include "Exception.h"
 
+// Affinity masks cover one processor group.
+const int OS::max_cpus = 64;
+
 const std::string OS::path_separator = "\\";
 
 const std::unordered_map<std::string, std::string> OS::standard_environment = {
@@ -105,6 +111,25 @@ static std::string utf16_to_utf8(const wchar_t *utf16) {
 }
 
 
+OS::MappedFile::MappedFile(const std::string &name) : data(NULL), size(0) {
+    auto file = std::ifstream(name, std::ios::binary);
+    if (!file) {
+        throw Exception("cannot open '" + name + "'", true);
+    }
+
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (file.bad()) {
+        throw Exception("error reading from '" + name + "'", true);
+    }
+    data = buffer.data();
+    size = buffer.size();
+}
+
+
+OS::MappedFile::~MappedFile() {
+}
+
+
 std::string OS::append_path_component(const std::string &directory, const std::string &name) {
     if (directory.empty() || directory == ".") {
         return native_path(name);
@@ -116,6 +141,24 @@ std::string OS::append_path_component(const std::string &directory, const std::s
 }
 
 
+bool OS::can_limit_process_group(bool memory, bool cpu) {
+    // TODO: implement
+    return false;
+}
+
+
+bool OS::can_sample_processes() {
+    // TODO: implement
+    return false;
+}
+
+
+bool OS::can_share_data_blocks(const std::string &directory) {
+    // TODO: implement using block cloning on ReFS
+    return false;
+}
+
+
 void OS::change_directory(const std::string &directory) {
     auto native_directory = native_path(directory);
     auto w_native_directory = utf8_to_utf16(native_directory);
@@ -126,6 +169,98 @@ void OS::change_directory(const std::string &directory) {
 }
 
 
+std::string OS::current_directory() {
+    char *cwd = _getcwd(NULL, 0);
+    if (cwd == NULL) {
+        throw Exception("can't get current directory", true);
+    }
+    auto directory = std::string(cwd);
+    free(cwd);
+    return directory;
+}
+
+
+bool OS::compare_files(const std::string &left, const std::string &right, std::string *difference) {
+    auto left_file = std::ifstream(left, std::ios::binary);
+    if (!left_file) {
+        throw Exception("cannot open '" + left + "'", true);
+    }
+
+    auto right_file = std::ifstream(right, std::ios::binary);
+    if (!right_file) {
+        throw Exception("cannot open '" + right + "'", true);
+    }
+
+    uint64_t offset = 0;
+    while (!left_file.eof()) {
+        char left_buf[8192], right_buf[8192];
+
+        left_file.read(left_buf, sizeof(left_buf));
+        if (left_file.bad()) {
+            throw Exception("error reading from '" + left + "'", true);
+        }
+
+        right_file.read(right_buf, sizeof(right_buf));
+        if (right_file.bad()) {
+            throw Exception("error reading from '" + right + "'", true);
+        }
+
+        auto length = std::min(left_file.gcount(), right_file.gcount());
+        auto mismatch = std::mismatch(left_buf, left_buf + length, right_buf);
+        if (mismatch.first != left_buf + length) {
+            if (difference != NULL) {
+                *difference = "first difference at byte " + std::to_string(offset + (mismatch.first - left_buf));
+            }
+            return false;
+        }
+        if (left_file.gcount() != right_file.gcount()) {
+            if (difference != NULL) {
+                *difference = "sizes differ";
+            }
+            return false;
+        }
+        offset += length;
+    }
+
+    if (!right_file.eof()) {
+        if (difference != NULL) {
+            *difference = "sizes differ";
+        }
+        return false;
+    }
+
+    return true;
+}
+
+
+void OS::copy_file(const std::string &from, const std::string &to) {
+    auto from_file = std::ifstream(from, std::ios::binary);
+    if (!from_file) {
+        throw Exception("cannot open '" + from + "'", true);
+    }
+
+    OS::ensure_directory(OS::dirname(to));
+
+    auto to_file = std::ofstream(to, std::ios::binary);
+    if (!to_file) {
+        throw Exception("cannot create '" + to + "'", true);
+    }
+
+    while (!from_file.eof()) {
+        char buf[8192];
+
+        from_file.read(buf, sizeof(buf));
+        if (from_file.bad()) {
+            throw Exception("error reading from '" + from + "'", true);
+        }
+        to_file.write(buf, from_file.gcount());
+        if (to_file.bad()) {
+            throw Exception("error writing to '" + to + "'", true);
+        }
+    }
+}
+
+
 void OS::create_directory(const std::string &directory) {
     auto native_directory = native_path(directory);
     auto w_native_directory = utf8_to_utf16(native_directory);
@@ -145,6 +280,21 @@ bool OS::directory_exists(const std::string &name) {
 }
 
 
+bool OS::is_writable(const std::string &name) {
+    DWORD attrs = GetFileAttributesW(utf8_to_utf16(native_path(name)).c_str());
+    return attrs != INVALID_FILE_ATTRIBUTES && !(attrs & FILE_ATTRIBUTE_READONLY);
+}
+
+
+void OS::make_read_only(const std::string &name) {
+    auto w_name = utf8_to_utf16(native_path(name));
+    DWORD attrs = GetFileAttributesW(w_name.c_str());
+    if (attrs == INVALID_FILE_ATTRIBUTES || !SetFileAttributesW(w_name.c_str(), attrs | FILE_ATTRIBUTE_READONLY)) {
+        throw Exception("can't make '" + name + "' read-only", true);
+    }
+}
+
+
 bool OS::file_exists(const std::string &file_name) {
     auto w_file_name = utf8_to_utf16(native_path(file_name));
     DWORD attrs = GetFileAttributesW(w_file_name.c_str());
@@ -156,6 +306,47 @@ bool OS::file_exists(const std::string &file_name) {
 }
 
 
+OS::DiskUsage OS::get_disk_usage(const std::string &directory, const std::vector<FileInfo> &excluded) {
+    DiskUsage usage;
+
+    // File sizes instead of allocated space, hard links and `excluded` are not detected.
+    for (const auto &entry : list_directory_entries(directory)) {
+        auto name = append_path_component(directory, entry.name);
+        usage.inodes += 1;
+        if (directory_exists(name)) {
+            auto subdirectory = get_disk_usage(name);
+            usage.bytes += subdirectory.bytes;
+            usage.inodes += subdirectory.inodes;
+        }
+        else {
+            usage.bytes += get_file_info(name).size;
+        }
+    }
+
+    return usage;
+}
+
+
+OS::FileInfo OS::get_file_info(const std::string &name) {
+    struct _stat64 st;
+
+    if (_wstat64(utf8_to_utf16(native_path(name)).c_str(), &st) < 0) {
+        throw Exception("can't stat '" + name + "'", true);
+    }
+
+    FileInfo info;
+    info.size = st.st_size;
+    info.modification_time = static_cast<int64_t>(st.st_mtime) * 1000000000;
+    return info;
+}
+
+
+int64_t OS::get_file_system_time(const std::string &directory) {
+    // Modification times have only a resolution of seconds.
+    return 0;
+}
+
+
 std::string OS::get_error_string() {
     wchar_t error_string[8192];
 
@@ -165,6 +356,12 @@ std::string OS::get_error_string() {
 }
 
 
+OS::SystemNoise OS::get_system_noise() {
+    // TODO: implement
+    return SystemNoise();
+}
+
+
 bool OS::is_absolute(const std::string &file_name) {
     if (file_name.empty()) {
         return false;
@@ -209,6 +406,42 @@ std::vector<std::string> OS::list_files(const std::string &directory) {
     return files;
 }
 
+void OS::link_file(const std::string &from, const std::string &to) {
+    ensure_directory(dirname(to));
+
+    if (!CreateHardLinkW(utf8_to_utf16(native_path(to)).c_str(), utf8_to_utf16(native_path(from)).c_str(), NULL)) {
+        copy_file(from, to);
+    }
+}
+
+
+std::vector<std::string> OS::list_directory(const std::string &directory) {
+    std::vector<std::string> names;
+
+    if (!directory_exists(directory)) {
+        return names;
+    }
+    for (const auto &name : list_files(directory)) {
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+
+    return names;
+}
+
+
+std::vector<OS::DirectoryEntry> OS::list_directory_entries(const std::string &directory) {
+    std::vector<DirectoryEntry> entries;
+
+    for (const auto &name : list_directory(directory)) {
+        entries.push_back(DirectoryEntry(name, FILE_TYPE_UNKNOWN));
+    }
+
+    return entries;
+}
+
+
 std::string OS::make_temp_directory(const std::string &directory, const std::string &name) {
     auto directory_template = append_path_component(directory, name + ".XXXXXXXX");
     // start points to first X, end after last
@@ -258,6 +491,29 @@ std::string OS::make_temp_directory(const std::string &directory, const std::str
 }
 
 
+std::string OS::memory_directory() {
+    return "";
+}
+
+
+bool OS::mount_private_memory_file_system(const std::string &directory) {
+    return false;
+}
+
+
+bool OS::move_file(const std::string &from, const std::string &to) {
+    // MoveFileEx doesn't replace existing files without MOVEFILE_REPLACE_EXISTING.
+    if (MoveFileEx(from.c_str(), to.c_str(), 0)) {
+        return true;
+    }
+    auto error = GetLastError();
+    if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND || error == ERROR_ALREADY_EXISTS) {
+        return false;
+    }
+    throw Exception("can't rename '" + from + "' to '" + to + "'");
+}
+
+
 void OS::remove_directory(const std::string &directory) {
     auto native_directory = native_path(directory);
     auto w_native_directory = utf8_to_utf16(native_directory);
@@ -268,12 +524,23 @@ void OS::remove_directory(const std::string &directory) {
 }
 
 
+std::vector<int> OS::select_benchmark_cpus() {
+    // TODO: implement
+    return std::vector<int>();
+}
+
+
 std::string OS::run_command(const Command *command, std::vector<std::string> *output, std::vector<std::string> *error_output) {
     // TODO: implement
     return "0";
 }
 
 
+void OS::run_in_background(const std::function<void()> &function) {
+    function();
+}
+
+
 std::string OS::operating_system() {
     return "Windows";
 }
@@ -35,8 +35,11 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <fstream>
+#include <stdexcept>
 
+#include "DataSource.h"
 #include "Exception.h"
 
 
@@ -52,73 +55,93 @@ std::string OS::basename(const std::string &name) {
 }
 
 
-bool OS::compare_files(const std::string &left, const std::string &right) {
-    auto left_file = std::ifstream(left);
-    if (!left_file) {
-        throw Exception("cannot open '" + left + "'", true);
+bool OS::compare_files(DataSource *from, const std::string &to, std::string *difference) {
+    if (!from->file_name().empty()) {
+        return compare_files(from->file_name(), to, difference);
     }
 
-    auto right_file = std::ifstream(right);
-    if (!right_file) {
-        throw Exception("cannot open '" + right + "'", true);
-    }
-    
-    while (!left_file.eof()) {
-        char left_buf[8192], right_buf[8192];
-        
-        left_file.read(left_buf, sizeof(left_buf));
-        if (left_file.bad()) {
-            throw Exception("error reading from '" + left + "'", true);
+    auto size = from->size();
+    if (size >= 0) {
+        auto to_size = get_file_info(to).size;
+        if (static_cast<uint64_t>(size) != to_size) {
+            if (difference != NULL) {
+                *difference = "sizes differ (" + std::to_string(size) + " and " + std::to_string(to_size) + " bytes)";
+            }
+            return false;
         }
-        
-        right_file.read(right_buf, sizeof(right_buf));
-        if (right_file.bad()) {
-            throw Exception("error reading from '" + right + "'", true);
+    }
+
+    auto to_file = std::ifstream(to, std::ios::binary);
+    if (!to_file) {
+        throw Exception("cannot open '" + to + "'", true);
+    }
+
+    const size_t buffer_size = 256 * 1024;
+    std::vector<char> from_buffer(buffer_size);
+    std::vector<char> to_buffer(buffer_size);
+    uint64_t offset = 0;
+
+    while (true) {
+        // Fill buffer completely, so both sides are compared in the same chunks.
+        size_t from_length = 0;
+        size_t n;
+        while (from_length < buffer_size && (n = from->read(from_buffer.data() + from_length, buffer_size - from_length)) > 0) {
+            from_length += n;
         }
 
-        if (left_file.gcount() != right_file.gcount()) {
+        to_file.read(to_buffer.data(), buffer_size);
+        if (to_file.bad()) {
+            throw Exception("error reading from '" + to + "'", true);
+        }
+        auto to_length = static_cast<size_t>(to_file.gcount());
+
+        auto length = std::min(from_length, to_length);
+        if (memcmp(from_buffer.data(), to_buffer.data(), length) != 0) {
+            if (difference != NULL) {
+                auto mismatch = std::mismatch(from_buffer.begin(), from_buffer.begin() + length, to_buffer.begin());
+                *difference = "first difference at byte " + std::to_string(offset + (mismatch.first - from_buffer.begin()));
+            }
             return false;
         }
-        
-        if (memcmp(left_buf, right_buf, left_file.gcount()) != 0) {
+        if (from_length != to_length) {
+            if (difference != NULL) {
+                *difference = "sizes differ";
+            }
             return false;
         }
+        if (from_length == 0) {
+            return true;
+        }
+        offset += length;
     }
-    
-    if (!right_file.eof()) {
-        return false;
-    }
-    
-    return true;
 }
 
 
-void
-OS::copy_file(const std::string &from, const std::string &to) {
-    auto from_file = std::ifstream(from);
-    if (!from_file) {
-        throw Exception("cannot open '" + from + "'", true);
+void OS::copy_file(DataSource *from, const std::string &to) {
+    if (!from->file_name().empty()) {
+        copy_file(from->file_name(), to);
+        return;
     }
-    
-    OS::ensure_directory(OS::dirname(to));
-    
-    auto to_file = std::ofstream(to);
+
+    ensure_directory(dirname(to));
+
+    auto to_file = std::ofstream(to, std::ios::binary);
     if (!to_file) {
-        throw Exception("cannot create '" + from + "'", true);
+        throw Exception("cannot create '" + to + "'", true);
     }
 
-    while (!from_file.eof()) {
-        char buf[8192];
-        
-        from_file.read(buf, sizeof(buf));
-        if (from_file.bad()) {
-            throw Exception("error reading from '" + from + "'", true);
-        }
-        to_file.write(buf, from_file.gcount());
+    std::vector<char> buffer(256 * 1024);
+    size_t n;
+    while ((n = from->read(buffer.data(), buffer.size())) > 0) {
+        to_file.write(buffer.data(), n);
         if (to_file.bad()) {
-            throw Exception("error writing to '" + from + "'", true);
+            throw Exception("error writing to '" + to + "'", true);
         }
     }
+    to_file.close();
+    if (to_file.fail()) {
+        throw Exception("error writing to '" + to + "'", true);
+    }
 }
 
 
@@ -140,7 +163,28 @@ void OS::ensure_directory(const std::string &directory) {
     }
     
     ensure_directory(dirname(directory));
-    create_directory(directory);
+    try {
+        create_directory(directory);
+    }
+    catch (Exception &e) {
+        // another process may have created it concurrently
+        if (!directory_exists(directory)) {
+            throw;
+        }
+    }
+}
+
+
+double OS::Statistics::startup_latency() const {
+    if (output.first >= 0 && (error_output.first < 0 || output.first < error_output.first)) {
+        return output.first;
+    }
+    else if (error_output.first >= 0) {
+        return error_output.first;
+    }
+    else {
+        return run_time;
+    }
 }
 
 
@@ -153,3 +197,58 @@ std::string OS::extension(const std::string &file_name) {
         return file_name.substr(pos + 1);
     }
 }
+
+
+OS::DiskUsage OS::get_disk_usage(const std::vector<std::string> &directories, const std::vector<FileInfo> &excluded) {
+    DiskUsage usage;
+    for (const auto &directory : directories) {
+        auto directory_usage = get_disk_usage(directory, excluded);
+        usage.bytes += directory_usage.bytes;
+        usage.inodes += directory_usage.inodes;
+    }
+    return usage;
+}
+
+
+std::vector<int> OS::parse_cpu_list(const std::string &list) {
+    std::vector<int> cpus;
+    std::string::size_type start = 0;
+
+    while (start < list.size()) {
+        auto end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        auto range = list.substr(start, end - start);
+        auto dash = range.find('-');
+
+        try {
+            size_t length;
+            auto first = std::stoi(range, &length);
+            auto last = first;
+            if (dash != std::string::npos) {
+                if (length != dash) {
+                    throw Exception("invalid CPU list '" + list + "'");
+                }
+                last = std::stoi(range.substr(dash + 1), &length);
+                length += dash + 1;
+            }
+            if (length != range.size() || first < 0 || last < first) {
+                throw Exception("invalid CPU list '" + list + "'");
+            }
+            if (last >= max_cpus) {
+                throw Exception("CPU " + std::to_string(last) + " in CPU list '" + list + "' out of range (maximum " + std::to_string(max_cpus - 1) + ")");
+            }
+            for (auto cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        catch (std::logic_error &e) {
+            throw Exception("invalid CPU list '" + list + "'");
+        }
+
+        start = end + 1;
+    }
+
+    return cpus;
+}
@@ -34,40 +34,238 @@
 #ifndef HAD_OS_H
 #define HAD_OS_H
 
+#include <stdint.h>
+
+#include <functional>
+
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+class DataSource;
+class FileIndex;
+
 class OS {
 public:
+    // Contents of a file, mapped into memory if possible.
+    class MappedFile {
+    public:
+        MappedFile(const std::string &name);
+        ~MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const uint8_t *data;
+        uint64_t size;
+
+    private:
+        // Contents, where mapping files is not supported.
+        std::vector<uint8_t> buffer;
+    };
+
+
+    struct StreamStatistics {
+        StreamStatistics() : bytes(0), first(-1), last(-1) { }
+        
+        // Number of bytes transferred.
+        uint64_t bytes;
+        
+        // Time of first and last transfer in seconds since the program was started, -1 if nothing was transferred.
+        double first;
+        double last;
+        
+        // Bytes transferred per second while the program was running.
+        double throughput() const { return last > 0 ? bytes / last : 0; }
+    };
+    
+    struct ProcessSample {
+        ProcessSample() : time(0), rss(0), processes(0), threads(0), open_files(0), read_bytes(0), write_bytes(0) { }
+        
+        // Time of sample in seconds since the program was started.
+        double time;
+        
+        // Totals over the program and all its descendants.
+        uint64_t rss;
+        uint64_t processes;
+        uint64_t threads;
+        uint64_t open_files;
+        uint64_t read_bytes;
+        uint64_t write_bytes;
+    };
+    
+    enum FileType {
+        FILE_TYPE_UNKNOWN,
+        FILE_TYPE_REGULAR,
+        FILE_TYPE_DIRECTORY,
+        FILE_TYPE_OTHER
+    };
+
+    struct DirectoryEntry {
+        DirectoryEntry(const std::string &name_, FileType type_) : name(name_), type(type_) { }
+
+        std::string name;
+        // Type of entry, FILE_TYPE_UNKNOWN for symbolic links or if it can't be determined without further system calls.
+        FileType type;
+    };
+
+    struct FileInfo {
+        FileInfo() : device(0), inode(0), size(0), modification_time(0), change_time(0) { }
+
+        // Identity of the file, device and inode are 0 where not supported.
+        uint64_t device;
+        uint64_t inode;
+
+        uint64_t size;
+
+        // Time of last modification in nanoseconds since the epoch.
+        int64_t modification_time;
+        // Time of last status change in nanoseconds since the epoch, 0 where not supported.
+        // Not compared, since creating links to a file changes it.
+        int64_t change_time;
+
+        bool operator==(const FileInfo &other) const { return device == other.device && inode == other.inode && size == other.size && modification_time == other.modification_time; }
+        bool operator!=(const FileInfo &other) const { return !(*this == other); }
+    };
+
+    struct GroupStatistics {
+        GroupStatistics() : valid(false), memory_peak(0), cpu_time(0), user_time(0), system_time(0), io_read_bytes(0), io_write_bytes(0) { }
+        
+        // Whether the program was run in its own control group and these values are set.
+        bool valid;
+        
+        // Totals over the program and all its descendants, including those that were killed at the end.
+        uint64_t memory_peak;
+        double cpu_time;
+        double user_time;
+        double system_time;
+        uint64_t io_read_bytes;
+        uint64_t io_write_bytes;
+    };
+    
+    struct DiskUsage {
+        DiskUsage() : bytes(0), inodes(0) { }
+
+        // Bytes allocated on disk, hard linked files are only counted once.
+        uint64_t bytes;
+        // Number of files, directories, and other entries.
+        uint64_t inodes;
+    };
+
+    struct Statistics {
+        Statistics() : run_time(0), max_rss(0), disk_usage_exceeded(false) { }
+        
+        // Time in seconds from starting the program until it exited.
+        double run_time;
+        
+        // Maximum resident set size of the program in bytes, as reported when it exited.
+        uint64_t max_rss;
+        
+        // Resource usage sampled while the program was running, see `Command::sample_interval`.
+        std::vector<ProcessSample> samples;
+        
+        // Resource usage of the control group the program was run in, see `Command::isolate`.
+        GroupStatistics group;
+        
+        // Peak disk usage of `Command::disk_usage_directories`, sampled while the program was running.
+        DiskUsage disk_usage;
+
+        // Whether the program was killed for exceeding `Command::disk_usage_max`.
+        bool disk_usage_exceeded;
+
+        // Data consumed on standard input, produced on standard output and error output.
+        StreamStatistics input;
+        StreamStatistics output;
+        StreamStatistics error_output;
+        
+        // Time in seconds from starting the program until its first output, or until it exited if it produced none.
+        double startup_latency() const;
+    };
+    
     struct Command {
-        Command() : input(NULL), limits(NULL) { }
+        Command() : batch_scheduling(false), cpu_max(0), disk_usage_max(0), file_size_max(0), input(NULL), input_data(NULL), isolate(false), limits(NULL), memory_max(0), nice(0), file_index(NULL), sample_interval(0), statistics(NULL) { }
         
         // The command line arguments, not including the program itself (argv[0]).
         std::vector<std::string> arguments;
         
+        // Run sub process with batch scheduling policy.
+        bool batch_scheduling;
+        
+        // Maximum number of CPUs the process group may use, 0 for no limit. Requires `isolate`.
+        double cpu_max;
+        
+        // CPUs to restrict sub process to, empty for no restriction.
+        std::vector<int> cpu_set;
+        
+        // Directories whose combined disk usage is sampled while the program runs, empty to disable. Requires `statistics`.
+        std::vector<std::string> disk_usage_directories;
+
+        // Files in `disk_usage_directories` that are not counted, e.g. read-only fixtures.
+        std::vector<FileInfo> disk_usage_excluded;
+
+        // Kill the program if disk usage of `disk_usage_directories` exceeds this many bytes, 0 for no limit.
+        uint64_t disk_usage_max;
+
         // Environment variables to set in sub process.
         std::vector<const std::unordered_map<std::string, std::string> *> environments;
+
+        // Maximum size of files the program may write, 0 for no limit.
+        uint64_t file_size_max;
         
         // Lines to feed program on standard input.
         std::vector<std::string> *input;
         
+        // Data to feed program on standard input, used if `input` is NULL and `input_file` is empty.
+        DataSource *input_data;
+
         // File to redirect standard input from.
         std::string input_file;
         
+        // Run sub process and all its descendants in their own process group (cgroup on Linux) if supported.
+        // Descendants still running when the program exits are killed.
+        bool isolate;
+        
         // Limits to set, currently not used.
         std::unordered_map<char, int> *limits;
         
+        // Maximum memory in bytes the process group may use, 0 for no limit. Requires `isolate`.
+        uint64_t memory_max;
+        
+        // Increment of the scheduling priority of the sub process.
+        int nice;
+        
         // List of directories in which to search for program.
         std::vector<std::string> path;
+
+        // Index used to search for program, NULL to check each directory in `path`.
+        FileIndex *file_index;
         
         // Preload shared library (not used on Windows).
         std::string preload_library;
         
         // Name of the program. This is used to search the executable and also as argv[0].
         std::string program;
+        
+        // Interval in seconds for sampling resource usage of the program, 0 to disable. Requires `statistics`.
+        double sample_interval;
+        
+        // If not NULL, timing and throughput of the run are stored here.
+        Statistics *statistics;
+    };
+
+    struct SystemNoise {
+        // Load averages over the last 1, 5, and 15 minutes.
+        std::string load_average;
+        
+        // CPU frequency scaling governor.
+        std::string governor;
+        
+        // Other processes that are currently running, as "name (pid)".
+        std::vector<std::string> busy_processes;
     };
 
+    // Number of CPUs that can be used in CPU affinity masks, CPU numbers must be below it.
+    static const int max_cpus;
+
     // Character used to separate path components.
     static const std::string path_separator;
     
@@ -80,17 +278,32 @@ public:
     // Return last path component.
     static std::string basename(const std::string &name);
     
+    // Check whether resource usage of running programs can be sampled.
+    static bool can_sample_processes();
+    
+    // Check whether memory and CPU usage of process groups can be limited.
+    static bool can_limit_process_group(bool memory, bool cpu);
+
+    // Check whether copies of files in `directory` can share data blocks with the original.
+    static bool can_share_data_blocks(const std::string &directory);
+    
     // Change the working directory to `directory`.
     static void change_directory(const std::string &directory);
     
+    // Get the absolute path of the current working directory.
+    static std::string current_directory();
+
     // Get all but last path components.
     static std::string dirname(const std::string &name);
     
     // Copy file `from` to file `to`, creating intermediary directories if neccessary.
     static void copy_file(const std::string &from, const std::string &to);
+    static void copy_file(DataSource *from, const std::string &to);
     
     // Compare files `from` and `to`, returning true if they have identical contents.
-    static bool compare_files(const std::string &from, const std::string &to);
+    // Otherwise, if `difference` is not NULL, a description of the first difference is stored there.
+    static bool compare_files(const std::string &from, const std::string &to, std::string *difference = NULL);
+    static bool compare_files(DataSource *from, const std::string &to, std::string *difference = NULL);
     
     // Create directory `name`.
     static void create_directory(const std::string &name);
@@ -107,21 +320,72 @@ public:
     // Check whether `name` exists and is a regular file.
     static bool file_exists(const std::string &name);
     
+    // Get disk usage of `directory` and its subdirectories, not including `directory` itself or the files `excluded`.
+    static DiskUsage get_disk_usage(const std::string &directory, const std::vector<FileInfo> &excluded = std::vector<FileInfo>());
+    static DiskUsage get_disk_usage(const std::vector<std::string> &directories, const std::vector<FileInfo> &excluded = std::vector<FileInfo>());
+
+    // Get identity, size and modification time of file `name`, following symbolic links.
+    static FileInfo get_file_info(const std::string &name);
+
+    // Get current time of the file system containing `directory`, as used for modification times, by updating the times of `directory`. Returns 0 if not supported.
+    static int64_t get_file_system_time(const std::string &directory);
+
     // Get string describing last system error.
     static std::string get_error_string();
     
+    // Get indicators of other activity on the system that could disturb measurements.
+    static SystemNoise get_system_noise();
+    
+    // Make `to` refer to file `from` without copying its contents: a hard link if possible, a symbolic link otherwise.
+    // Writing to `to` modifies `from`, so only use this for files the current user can't write.
+    // Creates intermediary directories if neccessary.
+    static void link_file(const std::string &from, const std::string &to);
+
+    // Return the names of entries in `directory`, unsorted and not including `.` and `..`; empty if `directory` doesn't exist.
+    static std::vector<std::string> list_directory(const std::string &directory);
+
+    // Like `list_directory`, but also return the types of entries.
+    static std::vector<DirectoryEntry> list_directory_entries(const std::string &directory);
+
     // Return a list of files in `directory` and its subdirectories, sorted alphabetically.
     static std::vector<std::string> list_files(const std::string &directory);
 
     // Check whether `name` is an absolute path name.
     static bool is_absolute(const std::string &name);
+
+    // Check whether the current user may write to file `name`.
+    static bool is_writable(const std::string &name);
+    
+    // Parse list of CPUs like `0-3,6`. CPU numbers must be below `max_cpus`.
+    static std::vector<int> parse_cpu_list(const std::string &list);
     
     // Make unique temporary directory in `directory`, using `name` as part of its name.
     static std::string make_temp_directory(const std::string &directory, const std::string &name);
     
+    // Get a directory private to the current user on a RAM-backed file system that is shared between processes
+    // (e. g. in /dev/shm), creating it if necessary. Returns empty string if there is none.
+    static std::string memory_directory();
+
+    // Remove write permission for everyone from file `name`.
+    static void make_read_only(const std::string &name);
+
+    // Mount a RAM-backed file system on `directory` that is only visible to this process and its children
+    // (using a mount namespace on Linux, inside a new user namespace unless privileged). Returns false if that is not supported.
+    static bool mount_private_memory_file_system(const std::string &directory);
+
+    // Rename `from` to `to` without replacing an existing `to`. Returns false if `from` doesn't exist or `to` already exists.
+    static bool move_file(const std::string &from, const std::string &to);
+
     // Recursively remove `directory`.
     static void remove_directory(const std::string &directory);
     
+    // Select idle CPUs for benchmarking: one hardware thread per core on the local NUMA node, avoiding cores with busy processes.
+    static std::vector<int> select_benchmark_cpus();
+    
+    // Run `function` in a detached process that outlives us, with standard input and output closed.
+    // Runs it directly where that is not supported.
+    static void run_in_background(const std::function<void()> &function);
+
     // Run command described by `command`, returning lines from standard output in `output` and error output  in `error_output`.
     static std::string run_command(const Command *command, std::vector<std::string> *output, std::vector<std::string> *error_output);
     
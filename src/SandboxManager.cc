@@ -0,0 +1,295 @@
+/*
+  SandboxManager.cc -- create and remove sandboxes
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "SandboxManager.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+#include "compat.h"
+#include "Exception.h"
+#include "OS.h"
+
+SandboxManager::SandboxManager(const Configuration &configuration) : background_cleanup(configuration.background_cleanup), directory(select_directory(configuration.sandbox_directories)), memory_backed(configuration.memory_sandboxes), needs_cleanup(false), pool_size(configuration.background_cleanup ? configuration.sandbox_pool : 0), templates_max(configuration.sandbox_templates_max) {
+    auto memory_mounted = false;
+    if (memory_backed) {
+        auto memory_directory = OS::memory_directory();
+        if (!memory_directory.empty()) {
+            directory = memory_directory;
+        }
+        else if (configuration.keep_sandbox != Configuration::NEVER) {
+            // A kept sandbox would vanish with the private mount.
+            std::cerr << getprogname() << ": warning: no shared RAM-backed file system, keeping sandboxes on disk\n";
+            memory_backed = false;
+        }
+        else {
+            // The mount goes away when we exit, taking all sandboxes with it, so neither pool nor trash are of use.
+            directory = OS::append_path_component(directory, ".nihtest-tmpfs");
+            OS::ensure_directory(directory);
+            if (!OS::mount_private_memory_file_system(directory)) {
+                throw Exception("no RAM-backed file system available for sandboxes");
+            }
+            background_cleanup = false;
+            pool_size = 0;
+            memory_mounted = true;
+        }
+    }
+    pool_directory = OS::append_path_component(directory, ".nihtest-pool");
+    trash_directory = OS::append_path_component(directory, ".nihtest-trash");
+    // Without shared data blocks, copying files from a template costs as much as staging them.
+    if (configuration.sandbox_template_size >= 0 && !memory_mounted && OS::can_share_data_blocks(directory)) {
+        template_directory = OS::append_path_component(directory, ".nihtest-templates");
+        if (!OS::is_absolute(template_directory)) {
+            template_directory = OS::append_path_component(OS::current_directory(), template_directory);
+        }
+    }
+}
+
+
+std::string SandboxManager::create(const std::string &name) {
+    if (pool_size > 0) {
+        needs_cleanup = true;
+
+        for (const auto &entry : OS::list_directory(pool_directory)) {
+            // Keep the random part of the name, so the sandbox name is still unique.
+            auto dot = entry.rfind('.');
+            if (dot == std::string::npos) {
+                continue;
+            }
+            auto sandbox = OS::append_path_component(directory, "sandbox_" + name + entry.substr(dot));
+            // Another test may have taken this entry already.
+            if (OS::move_file(OS::append_path_component(pool_directory, entry), sandbox)) {
+                if (memory_backed) {
+                    OS::create_directory(temp_directory(sandbox));
+                }
+                return sandbox;
+            }
+        }
+    }
+
+    auto sandbox = OS::make_temp_directory(directory, "sandbox_" + name);
+    if (memory_backed) {
+        OS::create_directory(temp_directory(sandbox));
+    }
+    return sandbox;
+}
+
+
+std::string SandboxManager::temp_directory(const std::string &sandbox) const {
+    if (!memory_backed) {
+        return "";
+    }
+    // Outside the sandbox, so temporary files don't show up as unexpected files.
+    return sandbox + ".tmp";
+}
+
+
+bool SandboxManager::copy_template(const std::string &key, const std::string &sandbox) const {
+    auto template_name = OS::append_path_component(template_directory, key);
+    if (!OS::directory_exists(template_name)) {
+        return false;
+    }
+
+    // Templates are on the same file system as the sandboxes, so copies share data blocks.
+    auto prefix_length = template_name.size() + OS::path_separator.size();
+    try {
+        for (const auto &file : OS::list_files(template_name)) {
+            OS::copy_file(file, OS::append_path_component(sandbox, file.substr(prefix_length)));
+        }
+        // Mark as recently used, see `remove_old_templates`.
+        OS::get_file_system_time(template_name);
+    }
+    catch (Exception &e) {
+        // Removed concurrently, the files copied so far are overwritten when staging.
+        return false;
+    }
+    return true;
+}
+
+
+void SandboxManager::add_template(const std::string &key, const std::string &sandbox, const std::vector<std::string> &files) const {
+    std::string new_template;
+
+    try {
+        OS::ensure_directory(template_directory);
+        // Build it under a temporary name, so other tests never see an incomplete template.
+        new_template = OS::make_temp_directory(template_directory, "new");
+        for (const auto &file : files) {
+            OS::copy_file(OS::append_path_component(sandbox, file), OS::append_path_component(new_template, file));
+        }
+        if (!OS::move_file(new_template, OS::append_path_component(template_directory, key))) {
+            // Another test created it concurrently.
+            OS::remove_directory(new_template);
+        }
+        else {
+            remove_old_templates(key);
+        }
+    }
+    catch (Exception &e) {
+        // Templates are only an optimization, the sandbox was set up without one.
+        if (!new_template.empty()) {
+            try {
+                OS::remove_directory(new_template);
+            }
+            catch (Exception &e) {
+            }
+        }
+    }
+}
+
+
+void SandboxManager::remove(const std::string &sandbox) {
+    dispose(sandbox);
+    if (memory_backed) {
+        dispose(temp_directory(sandbox));
+    }
+}
+
+
+void SandboxManager::dispose(const std::string &directory) {
+    if (background_cleanup) {
+        OS::ensure_directory(trash_directory);
+        if (OS::move_file(directory, OS::append_path_component(trash_directory, OS::basename(directory)))) {
+            needs_cleanup = true;
+            return;
+        }
+    }
+
+    OS::remove_directory(directory);
+}
+
+
+void SandboxManager::finish() {
+    // Refilling the pool on the test's own path would add the latency the pool is meant to remove, so it is only done in the background.
+    if (!needs_cleanup || !background_cleanup) {
+        return;
+    }
+    needs_cleanup = false;
+
+    OS::run_in_background([this]() { clean_up(); });
+}
+
+
+void SandboxManager::remove_old_templates(const std::string &keep) const {
+    struct Template {
+        std::string name;
+        int64_t last_used;
+        uint64_t size;
+    };
+
+    std::vector<Template> templates;
+    uint64_t total_size = 0;
+    for (const auto &entry : OS::list_directory(template_directory)) {
+        // Skip templates being built or removed.
+        if (entry == keep || entry.find('.') != std::string::npos) {
+            continue;
+        }
+        auto name = OS::append_path_component(template_directory, entry);
+        try {
+            auto size = OS::get_disk_usage(name).bytes;
+            templates.push_back(Template{entry, OS::get_file_info(name).modification_time, size});
+            total_size += size;
+        }
+        catch (Exception &e) {
+            // removed concurrently
+        }
+    }
+    total_size += OS::get_disk_usage(OS::append_path_component(template_directory, keep)).bytes;
+
+    std::sort(templates.begin(), templates.end(), [](const Template &a, const Template &b) { return a.last_used < b.last_used; });
+    for (const auto &old : templates) {
+        if (total_size <= static_cast<uint64_t>(templates_max)) {
+            break;
+        }
+        // Rename it first, so no other test starts copying from it.
+        auto removed_name = OS::append_path_component(template_directory, "old." + old.name);
+        if (OS::move_file(OS::append_path_component(template_directory, old.name), removed_name)) {
+            OS::remove_directory(removed_name);
+        }
+        total_size -= std::min(total_size, old.size);
+    }
+}
+
+
+std::string SandboxManager::select_directory(const std::vector<Configuration::SandboxDirectory> &directories) {
+    if (directories.empty()) {
+        return "";
+    }
+    if (directories.size() == 1) {
+        return directories[0].directory;
+    }
+
+    // Sandboxes of running tests (and kept ones) are the load; pool, trash, and templates are hidden directories.
+    std::vector<double> loads;
+    for (const auto &root : directories) {
+        size_t sandboxes = 0;
+        for (const auto &entry : OS::list_directory(root.directory)) {
+            if (entry.compare(0, 8, "sandbox_") == 0) {
+                sandboxes++;
+            }
+        }
+        loads.push_back((static_cast<double>(sandboxes) + 1) / root.weight);
+    }
+
+    // Tests starting at the same time see the same loads, start at a random directory so they don't all pick the same one.
+    std::random_device random;
+    auto start = std::uniform_int_distribution<size_t>(0, directories.size() - 1)(random);
+    auto best = start;
+    for (size_t i = 1; i < directories.size(); i++) {
+        auto index = (start + i) % directories.size();
+        if (loads[index] < loads[best]) {
+            best = index;
+        }
+    }
+    return directories[best].directory;
+}
+
+
+void SandboxManager::clean_up() const {
+    // Other tests may be cleaning up concurrently, so entries can vanish while we remove them.
+    for (const auto &entry : OS::list_directory(trash_directory)) {
+        try {
+            OS::remove_directory(OS::append_path_component(trash_directory, entry));
+        }
+        catch (Exception &e) {
+        }
+    }
+
+    if (pool_size > 0) {
+        OS::ensure_directory(pool_directory);
+        for (auto n = OS::list_directory(pool_directory).size(); n < pool_size; n++) {
+            OS::make_temp_directory(pool_directory, "sandbox");
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/*
+  SandboxManager.h -- create and remove sandboxes
+  Copyright (C) 2020 Dieter Baron and Thomas Klausner
+
+  This file is part of nihtest, regression tests for command line utilities.
+  The authors can be contacted at <nihtest@nih.at>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+  1. Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+  3. The names of the authors may not be used to endorse or promote
+     products derived from this software without specific prior
+     written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE AUTHORS ``AS IS'' AND ANY EXPRESS
+  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef HAD_SANDBOX_MANAGER_H
+#define HAD_SANDBOX_MANAGER_H
+
+#include <string>
+#include <vector>
+
+#include "Configuration.h"
+
+class SandboxManager {
+public:
+    SandboxManager(const Configuration &configuration);
+
+    // Get an empty sandbox directory for test `name`, taking it from the pool if possible.
+    std::string create(const std::string &name);
+
+    // Get directory to use for temporary files of programs run in `sandbox`, empty for the system default.
+    std::string temp_directory(const std::string &sandbox) const;
+
+    bool templates_enabled() const { return !template_directory.empty(); }
+
+    // Copy files of template `key` into `sandbox`, returning false if there is no such template.
+    bool copy_template(const std::string &key, const std::string &sandbox) const;
+
+    // Create template `key` from `files` in `sandbox`, unless it already exists.
+    void add_template(const std::string &key, const std::string &sandbox, const std::vector<std::string> &files) const;
+
+    // Dispose of `sandbox`, either removing it directly or moving it to the trash for later removal.
+    void remove(const std::string &sandbox);
+
+    // Empty the trash and refill the pool, in the background if so configured.
+    void finish();
+
+private:
+    bool background_cleanup;
+    std::string directory;
+    bool memory_backed;
+    bool needs_cleanup;
+    std::string pool_directory;
+    size_t pool_size;
+    // Absolute, since templates are used from within the sandbox.
+    std::string template_directory;
+    int64_t templates_max;
+    std::string trash_directory;
+
+    void clean_up() const;
+    void dispose(const std::string &directory);
+    // Remove least recently used templates other than `keep` until their total size is within `templates_max`.
+    void remove_old_templates(const std::string &keep) const;
+    // Choose the directory with the fewest sandboxes relative to its weight.
+    static std::string select_directory(const std::vector<Configuration::SandboxDirectory> &directories);
+};
+
+#endif // HAD_SANDBOX_MANAGER_H
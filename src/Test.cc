@@ -34,40 +34,109 @@
 #include "Test.h"
 
 #include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <regex>
+#include <sstream>
+#include <thread>
 
 #include "CompareArrays.h"
+#include "CompareDirectoryTree.h"
 #include "CompareFiles.h"
+#include "CompressedDataSource.h"
+#include "Digest.h"
 #include "Exception.h"
+#include "GeneratedDataSource.h"
 #include "OS.h"
 #include "Parser.h"
 
+// Pattern for generated data repeating the contents of a file.
+static const std::string repeat_prefix = "repeat:";
+static const std::string only_one_input = "only one of 'stdin', 'stdin-file', 'stdin-generate', or 'stdin-repeat' allowed";
+
+static std::string format_bytes(double bytes) {
+    static const std::vector<std::string> units = { "bytes", "KiB", "MiB", "GiB", "TiB" };
+    size_t unit = 0;
+
+    while (bytes >= 1024 && unit < units.size() - 1) {
+        bytes /= 1024;
+        unit++;
+    }
+
+    std::ostringstream stream;
+    stream << std::fixed << std::setprecision(unit == 0 ? 0 : 2) << bytes << " " << units[unit];
+    return stream.str();
+}
+
+
+static std::string format_usage(const std::string &resource, uint64_t value) {
+    if (resource == "threads" || resource == "open-files") {
+        return std::to_string(value);
+    }
+    else {
+        return format_bytes(value);
+    }
+}
+
+
+static std::string format_seconds(double seconds) {
+    std::ostringstream stream;
+    if (seconds < 1) {
+        stream << std::fixed << std::setprecision(3) << seconds * 1000 << "ms";
+    }
+    else {
+        stream << std::fixed << std::setprecision(3) << seconds << "s";
+    }
+    return stream.str();
+}
+
+
 const std::vector<Parser::Directive> Test::directives = {
     Parser::Directive("args", "[arg ...]", 0, true, false, -1),
+    Parser::Directive("cpu-max", "cpus", 1, true),
     Parser::Directive("description", "text", -1, true),
+    Parser::Directive("dir-tree", "test in [out]", 2, false, false, 3),
+    Parser::Directive("dir-tree-new", "test out", 2),
     Parser::Directive("features", "feature ...", 1, true, false, -1),
     Parser::Directive("file", "test in [out]", 2, false, false, 3),
     Parser::Directive("file-del", "test in", 2),
+    Parser::Directive("file-generate", "test size pattern [seed]", 3, false, false, 4),
+    Parser::Directive("file-generated", "test command [args ...]", 2, false, false, -1),
     Parser::Directive("file-new", "test out", 2),
+    Parser::Directive("file-ro", "test in", 2),
 //    Parser::Directive("mkdir", "mode name", 2),
+    Parser::Directive("max-open-files", "count", 1, true),
+    Parser::Directive("max-read-bytes", "size", 1, true),
+    Parser::Directive("max-rss", "size", 1, true),
+    Parser::Directive("max-sandbox-size", "size", 1, true),
+    Parser::Directive("max-startup-latency", "seconds", 1, true),
+    Parser::Directive("max-threads", "count", 1, true),
+    Parser::Directive("max-write-bytes", "size", 1, true),
+    Parser::Directive("memory-max", "size", 1, true),
+    Parser::Directive("min-speedup", "threads factor", 2),
+    Parser::Directive("min-throughput", "stream bytes-per-second", 2),
     Parser::Directive("precheck", "command [args ...]", 1, false, false, -1),
     Parser::Directive("preload", "library", 1, true),
     Parser::Directive("program", "name", 1, true),
     Parser::Directive("return", "exit-code", 1, true, true),
+    Parser::Directive("sample-interval", "seconds", 1, true),
     Parser::Directive("setenv", "variable value", 2),
     Parser::Directive("stderr", "text", -1),
     Parser::Directive("stderr-replace", "pattern replacement", 2),
     Parser::Directive("stdin", "text", -1),
     Parser::Directive("stdin-file", "file", 1, true),
+    Parser::Directive("stdin-generate", "size pattern [seed]", 2, true, false, 3),
+    Parser::Directive("stdin-repeat", "file count", 2, true),
     Parser::Directive("stdout", "text", -1),
+    Parser::Directive("thread-sweep", "variable threads ...", 2, true, false, -1),
 //    Parser::Directive("touch", "date time file", 3),
 //    Parser::Directive("ulimit", "limit value", 2)
 };
 
 
-Test::Test(const std::string &test_case, Configuration configuration_) : configuration(configuration_), run_test(true), in_sandbox(false), features_read(false) {
+Test::Test(const std::string &test_case, Configuration configuration_) : configuration(configuration_), build_directory(OS::current_directory()), digests(configuration.digest_cache), file_index(configuration.file_index_cache), run_test(true), cpu_max(0), max_sandbox_size(0), max_startup_latency(-1), memory_max(0), input_repeat(1), sample_interval(0), in_sandbox(false), noise_recorded(false), sandboxes(configuration), features_read(false) {
     auto file_name = test_case;
     name = OS::basename(test_case);
     auto dot = name.find('.');
@@ -77,6 +146,10 @@ Test::Test(const std::string &test_case, Configuration configuration_) : configu
     else {
         file_name += ".test";
     }
+
+    if (!configuration.fixture_archive.empty() && OS::file_exists(configuration.fixture_archive)) {
+        fixtures = std::make_shared<FixtureArchive>(configuration.fixture_archive);
+    }
         
     auto test_file_name = find_file(file_name);
     
@@ -100,26 +173,229 @@ Test::Test(const std::string &test_case, Configuration configuration_) : configu
     if (!touch_files.empty()) {
         throw Exception("touch not implemented yet");
     }
+    if (!maximum_usage.empty() && sample_interval == 0) {
+        sample_interval = 0.1;
+    }
+    for (const auto &pair : minimum_speedups) {
+        if (std::find(thread_counts.begin(), thread_counts.end(), pair.first) == thread_counts.end()) {
+            throw Exception("min-speedup for " + std::to_string(pair.first) + " threads, which are not part of thread-sweep");
+        }
+    }
 
     std::sort(files.begin(), files.end());
     
     rewrite_lines(error_output_replace, &error_output);
 }
 
+void Test::check_speedups(const std::vector<ThreadRun> &runs) {
+    const auto &base = runs.front();
+    auto ok = true;
+
+    for (const auto &run : runs) {
+        auto speedup = base.seconds / run.seconds;
+        auto minimum = minimum_speedups.find(run.threads);
+        if (minimum != minimum_speedups.end() && speedup < minimum->second) {
+            failed.push_back("speedup with " + std::to_string(run.threads) + " threads");
+            ok = false;
+        }
+    }
+
+    if (configuration.print_results == Configuration::NEVER || (ok && configuration.print_results != Configuration::ALWAYS)) {
+        return;
+    }
+
+    std::cout << "Thread scaling:\n";
+    std::cout << "threads      time  speedup  efficiency\n";
+    for (const auto &run : runs) {
+        auto speedup = base.seconds / run.seconds;
+        auto efficiency = speedup * base.threads / run.threads;
+        std::ostringstream line;
+        line << std::setw(7) << run.threads << std::fixed << std::setprecision(3) << std::setw(9) << run.seconds << "s" << std::setprecision(2) << std::setw(9) << speedup << std::setprecision(0) << std::setw(11) << efficiency * 100 << "%";
+        auto minimum = minimum_speedups.find(run.threads);
+        if (minimum != minimum_speedups.end()) {
+            line << std::setprecision(2) << "  (minimum " << minimum->second << ")";
+        }
+        std::cout << line.str() << "\n";
+    }
+}
+
+
+void Test::check_statistics(const OS::Statistics &statistics) {
+    const std::vector<std::pair<std::string, const OS::StreamStatistics *>> streams = {
+        { "stdin", &statistics.input },
+        { "stdout", &statistics.output },
+        { "stderr", &statistics.error_output }
+    };
+    auto ok = true;
+
+    if (max_startup_latency >= 0 && statistics.startup_latency() > max_startup_latency) {
+        failed.push_back("startup latency" + variant);
+        ok = false;
+    }
+    for (const auto &stream : streams) {
+        auto minimum = minimum_throughputs.find(stream.first);
+        if (minimum != minimum_throughputs.end() && stream.second->throughput() < minimum->second) {
+            failed.push_back(stream.first + " throughput" + variant);
+            ok = false;
+        }
+    }
+
+    if (max_sandbox_size > 0 && (statistics.disk_usage_exceeded || statistics.disk_usage.bytes > max_sandbox_size)) {
+        failed.push_back("sandbox size" + variant);
+        ok = false;
+    }
+
+    std::unordered_map<std::string, uint64_t> peaks;
+    peaks["rss"] = statistics.max_rss;
+    for (const auto &sample : statistics.samples) {
+        peaks["rss"] = std::max(peaks["rss"], sample.rss);
+        peaks["threads"] = std::max(peaks["threads"], sample.threads);
+        peaks["open-files"] = std::max(peaks["open-files"], sample.open_files);
+        peaks["read-bytes"] = std::max(peaks["read-bytes"], sample.read_bytes);
+        peaks["write-bytes"] = std::max(peaks["write-bytes"], sample.write_bytes);
+    }
+    for (const auto &maximum : maximum_usage) {
+        if (peaks[maximum.first] > maximum.second) {
+            failed.push_back(maximum.first + variant);
+            ok = false;
+        }
+    }
+
+    if (configuration.print_results == Configuration::NEVER || (ok && configuration.print_results != Configuration::ALWAYS)) {
+        return;
+    }
+
+    std::cout << "Statistics" << variant << ":\n";
+    std::cout << "  run time: " << format_seconds(statistics.run_time) << "\n";
+    std::cout << "  startup latency: " << format_seconds(statistics.startup_latency());
+    if (max_startup_latency >= 0) {
+        std::cout << " (maximum " << format_seconds(max_startup_latency) << ")";
+    }
+    std::cout << "\n";
+    for (const auto &stream : streams) {
+        if (stream.second->bytes == 0) {
+            continue;
+        }
+        std::cout << "  " << stream.first << ": " << format_bytes(stream.second->bytes) << ", " << format_bytes(stream.second->throughput()) << "/s";
+        auto minimum = minimum_throughputs.find(stream.first);
+        if (minimum != minimum_throughputs.end()) {
+            std::cout << " (minimum " << format_bytes(minimum->second) << "/s)";
+        }
+        std::cout << "\n";
+    }
+    if (statistics.max_rss > 0) {
+        std::cout << "  maximum resident set size: " << format_bytes(statistics.max_rss) << "\n";
+    }
+    std::cout << "  sandbox: peak " << format_bytes(statistics.disk_usage.bytes) << ", " << statistics.disk_usage.inodes << " inodes";
+    if (max_sandbox_size > 0) {
+        std::cout << " (maximum " << format_bytes(max_sandbox_size) << ")";
+    }
+    if (statistics.disk_usage_exceeded) {
+        std::cout << ", program killed for exceeding the maximum";
+    }
+    std::cout << "\n";
+    if (statistics.group.valid) {
+        std::cout << "  process group: ";
+        if (statistics.group.memory_peak > 0) {
+            std::cout << "memory peak " << format_bytes(statistics.group.memory_peak) << ", ";
+        }
+        std::cout << "CPU time " << format_seconds(statistics.group.cpu_time) << " (user " << format_seconds(statistics.group.user_time) << ", system " << format_seconds(statistics.group.system_time) << ")";
+        std::cout << ", I/O read " << format_bytes(statistics.group.io_read_bytes) << ", written " << format_bytes(statistics.group.io_write_bytes) << "\n";
+    }
+    for (const auto &maximum : maximum_usage) {
+        std::cout << "  peak " << maximum.first << ": " << format_usage(maximum.first, peaks[maximum.first]) << " (maximum " << format_usage(maximum.first, maximum.second) << ")\n";
+    }
+    if (!statistics.samples.empty()) {
+        print_samples(statistics.samples);
+    }
+}
+
+
+void Test::check_read_only_files(const std::vector<OS::FileInfo> &staged) {
+    auto staged_file = staged.cbegin();
+    auto ok = true;
+
+    for (const auto &file : files) {
+        if (!file.read_only) {
+            continue;
+        }
+        const auto &expected = *(staged_file++);
+
+        std::string problem;
+        auto source_name = find_data(file.input)->file_name();
+        // Only a linked source can be modified through the sandbox.
+        if (!source_name.empty() && expected.inode != 0) {
+            auto source = OS::get_file_info(source_name);
+            if (source.device == expected.device && source.inode == expected.inode && source != expected) {
+                problem = "source '" + file.input + "' was modified";
+            }
+        }
+        // A missing file is reported by compare_files().
+        if (problem.empty() && OS::file_exists(file.name) && OS::get_file_info(file.name) != expected) {
+            problem = "was modified";
+        }
+
+        if (!problem.empty()) {
+            if (configuration.print_results != Configuration::NEVER) {
+                std::cout << "Read-only file '" << file.name << "' " << problem << ".\n";
+            }
+            ok = false;
+
+            auto entry = generated_entries.find(file.name);
+            if (entry != generated_entries.end() && OS::directory_exists(entry->second)) {
+                // Don't let other tests use the modified output.
+                OS::remove_directory(entry->second);
+            }
+        }
+    }
+
+    if (!ok) {
+        failed.push_back("read-only files" + variant);
+    }
+}
+
+
 void Test::compare_arrays(const std::vector<std::string> &expected, const std::vector<std::string> &got, const std::string &what) {
-    auto compare = CompareArrays(expected, got, what, configuration.print_results != Configuration::NEVER);
+    auto compare = CompareArrays(expected, got, what + variant, configuration.print_results != Configuration::NEVER);
     if (!compare.compare()) {
-        failed.push_back(what);
+        failed.push_back(what + variant);
     }
 }
 
 
-void Test::compare_files() {
-    std::vector<std::string> files_got = OS::list_files(".");
-    
-    auto compare = CompareFiles(files, files_got, this, configuration.print_results != Configuration::NEVER);
+void Test::compare_files(const std::unordered_map<std::string, OS::FileInfo> &staged_expected) {
+    std::vector<std::string> files_got;
+    std::vector<std::vector<std::string>> trees_got(directory_trees.size());
+
+    for (const auto &file : OS::list_files(".")) {
+        size_t index;
+        for (index = 0; index < directory_trees.size(); index++) {
+            const auto &prefix = directory_trees[index].name;
+            if (file.size() > prefix.size() && file.compare(0, prefix.size(), prefix) == 0 && file.compare(prefix.size(), OS::path_separator.size(), OS::path_separator) == 0) {
+                trees_got[index].push_back(file.substr(prefix.size() + OS::path_separator.size()));
+                break;
+            }
+        }
+        if (index == directory_trees.size()) {
+            files_got.push_back(file);
+        }
+    }
+
+    auto compare = CompareFiles(files, files_got, staged_expected, this, configuration.print_results != Configuration::NEVER);
     if (!compare.compare()) {
-        failed.push_back("files");
+        failed.push_back("files" + variant);
+    }
+
+    auto trees_ok = true;
+    for (size_t index = 0; index < directory_trees.size(); index++) {
+        const auto &tree = directory_trees[index];
+        auto compare_tree = CompareDirectoryTree(tree.name, find_directory(tree.output), trees_got[index], configuration.print_results != Configuration::NEVER);
+        if (!compare_tree.compare()) {
+            trees_ok = false;
+        }
+    }
+    if (!trees_ok) {
+        failed.push_back("directory trees" + variant);
     }
 }
 
@@ -129,7 +405,7 @@ void Test::enter_sandbox() {
 	throw Exception("already in sandbox");
     }
 
-    sandbox_name = OS::make_temp_directory(configuration.sandbox_directory, "sandbox_" + name);
+    sandbox_name = sandboxes.create(name);
 
     OS::change_directory(sandbox_name);
     in_sandbox = true;
@@ -145,6 +421,12 @@ Test::Result Test::execute_test() {
     }
     
     // TODO: skip if limits &c not supported
+    if (sample_interval > 0 && !OS::can_sample_processes()) {
+        return SKIPPED;
+    }
+    if ((memory_max > 0 || cpu_max > 0) && !OS::can_limit_process_group(memory_max > 0, cpu_max > 0)) {
+        return SKIPPED;
+    }
     
     if (!required_features.empty()) {
         for (const auto &feature : required_features) {
@@ -159,6 +441,7 @@ Test::Result Test::execute_test() {
         command.program = find_file(precheck_command[0]);
         command.arguments.insert(command.arguments.begin(), precheck_command.begin() + 1, precheck_command.end());
         command.path.push_back(".");
+        command.file_index = &file_index;
 
         std::vector<std::string> output;
         std::vector<std::string> error_output;
@@ -170,68 +453,145 @@ Test::Result Test::execute_test() {
         }
     }
     
-    enter_sandbox();
-    
-    try {
-        for (const auto &file : files) {
-            if (!file.input.empty()) {
-                OS::copy_file(find_file(file.input), file.name);
-            }
-        }
-        
-        std::vector<std::string> error_output_got;
-        std::vector<std::string> output_got;
-        
-        OS::Command command;
-        command.arguments = arguments;
-        command.environments.push_back(&OS::standard_environment);
-        if (!environment.empty()) {
-            command.environments.push_back(&environment);
+    generate_files();
+
+    if (configuration.record_noise != Configuration::NEVER) {
+        noise = OS::get_system_noise();
+        noise_recorded = true;
+    }
+    if (configuration.automatic_cpu_affinity) {
+        cpu_set = OS::select_benchmark_cpus();
+    }
+    else {
+        cpu_set = configuration.cpu_affinity;
+    }
+
+    if (thread_counts.empty()) {
+        run_in_sandbox(0);
+    }
+    else {
+        std::vector<ThreadRun> runs;
+
+        for (auto threads : thread_counts) {
+            variant = " with " + std::to_string(threads) + " threads";
+            runs.push_back(ThreadRun(threads, run_in_sandbox(threads)));
         }
-        if (!input.empty()) {
-            command.input = &input;
+        variant = "";
+
+        check_speedups(runs);
+    }
+
+    return failed.empty() ? PASSED : FAILED;
+}
+
+
+std::shared_ptr<DataSource> Test::generate_data(const std::string &name, const Generator &generator) const {
+    if (generator.pattern.compare(0, repeat_prefix.size(), repeat_prefix) == 0) {
+        auto file = generator.pattern.substr(repeat_prefix.size());
+        return std::make_shared<RepeatDataSource>(name, [this, file]() { return find_data(file); }, 0, static_cast<int64_t>(generator.size));
+    }
+    return std::make_shared<GeneratedDataSource>(name, GeneratedDataSource::pattern(generator.pattern), generator.size, generator.seed);
+}
+
+
+void Test::generate_files() {
+    if (generated_files.empty()) {
+        return;
+    }
+
+    auto cache_directory = OS::is_absolute(configuration.generated_cache) ? configuration.generated_cache : OS::append_path_component(build_directory, configuration.generated_cache);
+
+    for (auto &file : files) {
+        auto it = generated_files.find(file.name);
+        if (it == generated_files.end()) {
+            continue;
         }
-        if (!input_file.empty()) {
-            command.input_file = find_file(input_file);
+        const auto &command_line = it->second;
+
+        auto program = find_file(command_line[0]);
+        if (!OS::is_absolute(program)) {
+            program = OS::append_path_component(build_directory, program);
         }
-        if (!limits.empty()) {
-            command.limits = &limits;
+
+        // Output is determined by the generator and its arguments, including the name of the file it creates.
+        Digest digest;
+        auto key_data = digests.digest(program) + '\0' + file.name;
+        for (size_t i = 1; i < command_line.size(); i++) {
+            key_data += '\0' + command_line[i];
         }
-        command.path.push_back("..");
-        command.path.push_back(OS::append_path_component(configuration.source_directory, ".."));
-        command.preload_library = preload_library;
-        command.program = program;
+        digest.update(key_data.data(), key_data.size());
+        auto entry = OS::append_path_component(cache_directory, digest.final());
+        auto cached_file = OS::append_path_component(entry, file.name);
 
-        auto exit_code_got = OS::run_command(&command, &output_got, &error_output_got);
-        
-        if (exit_code != exit_code_got) {
-            failed.push_back("exit status");
-            if (configuration.print_results != Configuration::NEVER) {
-                std::cout << "Exit code not as expected:\n";
-                std::cout << "-" << exit_code << "\n";
-                std::cout << "+" << exit_code_got << "\n";
+        if (!OS::file_exists(cached_file)) {
+            OS::ensure_directory(cache_directory);
+            // Generate under a temporary name, so other tests never see incomplete output.
+            auto directory = OS::make_temp_directory(cache_directory, "new");
+            try {
+                OS::Command command;
+                command.program = program;
+                command.arguments.insert(command.arguments.begin(), command_line.begin() + 1, command_line.end());
+                command.environments.push_back(&OS::standard_environment);
+
+                std::vector<std::string> output;
+                std::vector<std::string> error_output;
+
+                OS::change_directory(directory);
+                std::string result;
+                try {
+                    result = OS::run_command(&command, &output, &error_output);
+                }
+                catch (Exception &e) {
+                    OS::change_directory(build_directory);
+                    throw;
+                }
+                OS::change_directory(build_directory);
+
+                if (result != "0") {
+                    throw Exception("generator for '" + file.name + "' failed with exit code " + result + (error_output.empty() ? "" : ": " + error_output[0]));
+                }
+                if (!OS::file_exists(OS::append_path_component(directory, file.name))) {
+                    throw Exception("generator didn't create '" + file.name + "'");
+                }
+                // Lets tests link to it instead of copying it.
+                OS::make_read_only(OS::append_path_component(directory, file.name));
+                if (!OS::move_file(directory, entry)) {
+                    // Another test generated it concurrently.
+                    OS::remove_directory(directory);
+                }
+            }
+            catch (Exception &e) {
+                OS::remove_directory(directory);
+                throw;
             }
         }
-        
-        std::vector<Replace> replacements;
-        
-        replacements.push_back(Replace(std::regex("^[^: ]*" + OS::basename(program) + ": "), ""));
-        replacements.insert(replacements.end(), error_output_replace.begin(), error_output_replace.end());
-        
-        rewrite_lines(replacements, &error_output_got);
-        
-        compare_arrays(output, output_got, "Output");
-        compare_arrays(error_output, error_output_got, "Error output");
-        
-        compare_files();
+
+        file.input = cached_file;
+        file.output = cached_file;
+        generated_entries[file.name] = entry;
     }
-    catch (Exception e) {
-        leave_sandbox(configuration.keep_sandbox != Configuration::NEVER);
-        throw;
+}
+
+
+std::string Test::find_directory(const std::string &name) const {
+    if (OS::is_absolute(name)) {
+        return name;
     }
-    
-    leave_sandbox(configuration.keep_sandbox == Configuration::ALWAYS || (configuration.keep_sandbox == Configuration::WHEN_FAILED && !failed.empty()));
-    return failed.empty() ? PASSED : FAILED;
+
+    auto build_name = OS::append_path_component(build_directory, name);
+    if (OS::directory_exists(build_name)) {
+        return build_name;
+    }
+
+    if (!configuration.source_directory.empty()) {
+        auto source_directory = OS::is_absolute(configuration.source_directory) ? configuration.source_directory : OS::append_path_component(build_directory, configuration.source_directory);
+        auto source_name = OS::append_path_component(source_directory, name);
+        if (OS::directory_exists(source_name)) {
+            return source_name;
+        }
+    }
+
+    throw Exception("can't find input directory '" + name + "'");
 }
 
 
@@ -239,27 +599,58 @@ std::string Test::find_file(const std::string &name) const {
     if (OS::is_absolute(name)) {
         return name;
     }
-    
+
+    auto file_name = locate_file(name);
+    if (file_name.empty()) {
+        throw Exception("can't find input file '" + name + "'");
+    }
+    return file_name;
+}
+
+
+std::string Test::locate_file(const std::string &name) const {
+    if (OS::is_absolute(name)) {
+        return OS::file_exists(name) ? name : "";
+    }
+
     std::string build_name;
     if (in_sandbox) {
-        build_name = OS::append_path_component("..", name);
+        build_name = OS::append_path_component(build_directory, name);
     }
     else {
         build_name = name;
     }
     
-    if (OS::file_exists(build_name)) {
+    if (file_index.file_exists(build_directory, name)) {
         return build_name;
     }
     
     if (!configuration.source_directory.empty()) {
         auto source_name = make_filename(configuration.source_directory, name);
-        if (OS::file_exists(source_name)) {
+        auto source_directory = OS::is_absolute(configuration.source_directory) ? configuration.source_directory : OS::append_path_component(build_directory, configuration.source_directory);
+        if (file_index.file_exists(source_directory, name)) {
             return source_name;
         }
     }
     
-    throw Exception("can't find input file '" + name + "'");
+    return "";
+}
+
+
+double Test::get_double(const std::string &string) {
+    size_t end;
+    double value;
+
+    try {
+        value = std::stod(string, &end);
+    }
+    catch (std::exception &e) {
+        throw Exception("invalid number '" + string + "'");
+    }
+    if (end != string.size()) {
+        throw Exception("invalid number '" + string + "'");
+    }
+    return value;
 }
 
 
@@ -269,6 +660,70 @@ int Test::get_int(const std::string &string) {
 }
 
 
+// Get status of files staged with their expected contents, which need not be compared if the program doesn't touch them.
+std::unordered_map<std::string, OS::FileInfo> Test::get_staged_expected_files() const {
+    std::unordered_map<std::string, OS::FileInfo> staged_expected;
+    for (const auto &file : files) {
+        if (!file.read_only && !file.input.empty() && file.input == file.output) {
+            staged_expected[file.name] = OS::get_file_info(file.name);
+        }
+    }
+    if (staged_expected.empty()) {
+        return staged_expected;
+    }
+
+    // Changes within the same tick of the file system clock as staging would go unnoticed.
+    int64_t last_change = 0;
+    uint64_t size = 0;
+    for (const auto &entry : staged_expected) {
+        last_change = std::max(last_change, entry.second.change_time);
+        size += entry.second.size;
+    }
+    auto now = OS::get_file_system_time(".");
+    // Waiting for the next tick is cheaper than reading large files.
+    const uint64_t wait_threshold = 1024 * 1024;
+    for (auto tries = 0; now != 0 && now <= last_change && size >= wait_threshold && tries < 50; tries++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        now = OS::get_file_system_time(".");
+    }
+    for (auto it = staged_expected.begin(); it != staged_expected.end(); ) {
+        if (it->second.inode == 0 || it->second.change_time == 0 || it->second.change_time >= now) {
+            it = staged_expected.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+
+    return staged_expected;
+}
+
+
+uint64_t Test::get_size(const std::string &string) {
+    static const std::string suffixes = "kMGT";
+    size_t end;
+    uint64_t value;
+
+    try {
+        value = std::stoull(string, &end);
+    }
+    catch (std::exception &e) {
+        throw Exception("invalid size '" + string + "'");
+    }
+    if (end + 1 == string.size()) {
+        auto index = suffixes.find(string[end]);
+        if (index == std::string::npos) {
+            throw Exception("invalid size '" + string + "'");
+        }
+        value <<= 10 * (index + 1);
+    }
+    else if (end != string.size()) {
+        throw Exception("invalid size '" + string + "'");
+    }
+    return value;
+}
+
+
 bool Test::has_feature(const std::string &name) {
     if (!features_read) {
         read_features();
@@ -279,9 +734,10 @@ bool Test::has_feature(const std::string &name) {
 
 
 void Test::leave_sandbox(bool keep) {
-    OS::change_directory("..");
+    OS::change_directory(build_directory);
+    in_sandbox = false;
     if (!keep) {
-        OS::remove_directory(sandbox_name);
+        sandboxes.remove(sandbox_name);
     }
     return;
 }
@@ -293,7 +749,7 @@ std::string Test::make_filename(const std::string &directory, const std::string
         real_directory = directory;
     }
     else {
-        real_directory = OS::append_path_component("..", directory);
+        real_directory = OS::append_path_component(build_directory, directory);
     }
     return OS::append_path_component(real_directory, name);
 }
@@ -303,6 +759,23 @@ void Test::process_directive(const Parser::Directive *directive, const std::vect
     if (directive->name == "args") {
         arguments = args;
     }
+    else if (directive->name == "cpu-max") {
+        cpu_max = get_double(args[0]);
+        if (cpu_max <= 0) {
+            throw Exception("invalid number of CPUs '" + args[0] + "'");
+        }
+    }
+    else if (directive->name == "dir-tree") {
+        if (args.size() == 2) {
+            directory_trees.push_back(DirectoryTree(args[0], args[1], args[1]));
+        }
+        else {
+            directory_trees.push_back(DirectoryTree(args[0], args[1], args[2]));
+        }
+    }
+    else if (directive->name == "dir-tree-new") {
+        directory_trees.push_back(DirectoryTree(args[0], "", args[1]));
+    }
     else if (directive->name == "features") {
         required_features = args;
     }
@@ -317,9 +790,70 @@ void Test::process_directive(const Parser::Directive *directive, const std::vect
     else if (directive->name == "file-del") {
         files.push_back(File(args[0], args[1], ""));
     }
+    else if (directive->name == "file-generate") {
+        auto generator = Generator(get_size(args[1]), args[2], args.size() > 3 ? get_size(args[3]) : 0);
+        if (generator.pattern.compare(0, repeat_prefix.size(), repeat_prefix) != 0) {
+            // Check pattern name now rather than when running the test.
+            GeneratedDataSource::pattern(generator.pattern);
+        }
+        auto data_name = "generated:" + args[0];
+        generators.insert({data_name, generator});
+        files.push_back(File(args[0], data_name, data_name));
+    }
+    else if (directive->name == "file-generated") {
+        if (generated_files.find(args[0]) != generated_files.end()) {
+            throw Exception("duplicate file-generated for '" + args[0] + "'");
+        }
+        generated_files[args[0]] = std::vector<std::string>(args.begin() + 1, args.end());
+        // Input is set to the cached output in generate_files().
+        files.push_back(File(args[0], "", "", true));
+    }
     else if (directive->name == "file-new") {
         files.push_back(File(args[0], "", args[1]));
     }
+    else if (directive->name == "file-ro") {
+        files.push_back(File(args[0], args[1], args[1], true));
+    }
+    else if (directive->name == "max-open-files") {
+        maximum_usage["open-files"] = get_size(args[0]);
+    }
+    else if (directive->name == "max-read-bytes") {
+        maximum_usage["read-bytes"] = get_size(args[0]);
+    }
+    else if (directive->name == "max-rss") {
+        maximum_usage["rss"] = get_size(args[0]);
+    }
+    else if (directive->name == "max-sandbox-size") {
+        max_sandbox_size = get_size(args[0]);
+    }
+    else if (directive->name == "max-startup-latency") {
+        max_startup_latency = get_double(args[0]);
+    }
+    else if (directive->name == "max-threads") {
+        maximum_usage["threads"] = get_size(args[0]);
+    }
+    else if (directive->name == "max-write-bytes") {
+        maximum_usage["write-bytes"] = get_size(args[0]);
+    }
+    else if (directive->name == "memory-max") {
+        memory_max = get_size(args[0]);
+    }
+    else if (directive->name == "min-speedup") {
+        auto threads = get_int(args[0]);
+        if (minimum_speedups.find(threads) != minimum_speedups.end()) {
+            throw Exception("duplicate min-speedup for " + args[0] + " threads");
+        }
+        minimum_speedups[threads] = get_double(args[1]);
+    }
+    else if (directive->name == "min-throughput") {
+        if (args[0] != "stdin" && args[0] != "stdout" && args[0] != "stderr") {
+            throw Exception("unknown stream '" + args[0] + "'");
+        }
+        if (minimum_throughputs.find(args[0]) != minimum_throughputs.end()) {
+            throw Exception("duplicate min-throughput for '" + args[0] + "'");
+        }
+        minimum_throughputs[args[0]] = get_size(args[1]);
+    }
     else if (directive->name == "mkdir") {
         if (directories.find(args[1]) != directories.end()) {
             throw Exception("duplicate mkdir for '" + args[1], "'");
@@ -327,11 +861,30 @@ void Test::process_directive(const Parser::Directive *directive, const std::vect
         directories[args[1]] = get_int(args[2]);
     }
     else if (directive->name == "stdin-file") {
-        if (!input.empty()) {
-            throw Exception("only one of 'stdin-file' or 'stdin' allowed");
+        if (has_input()) {
+            throw Exception(only_one_input);
         }
         input_file = args[0];
     }
+    else if (directive->name == "stdin-generate") {
+        if (has_input()) {
+            throw Exception(only_one_input);
+        }
+        input_generator = std::make_shared<Generator>(get_size(args[0]), args[1], args.size() > 2 ? get_size(args[2]) : 0);
+        if (input_generator->pattern.compare(0, repeat_prefix.size(), repeat_prefix) != 0) {
+            GeneratedDataSource::pattern(input_generator->pattern);
+        }
+    }
+    else if (directive->name == "stdin-repeat") {
+        if (has_input()) {
+            throw Exception(only_one_input);
+        }
+        input_file = args[0];
+        input_repeat = get_size(args[1]);
+        if (input_repeat == 0) {
+            throw Exception("invalid repeat count '" + args[1] + "'");
+        }
+    }
     else if (directive->name == "precheck") {
         precheck_command = args;
     }
@@ -344,6 +897,12 @@ void Test::process_directive(const Parser::Directive *directive, const std::vect
     else if (directive->name == "return") {
         exit_code = args[0];
     }
+    else if (directive->name == "sample-interval") {
+        sample_interval = get_double(args[0]);
+        if (sample_interval <= 0) {
+            throw Exception("invalid sample interval '" + args[0] + "'");
+        }
+    }
     else if (directive->name == "setenv") {
         if (environment.find(args[0]) != environment.end()) {
             throw Exception("duplicate setenv for '" + args[0] + "'");
@@ -357,14 +916,24 @@ void Test::process_directive(const Parser::Directive *directive, const std::vect
         error_output_replace.push_back(Replace(std::regex(args[0]), args[1]));
     }
     else if (directive->name == "stdin") {
-        if (!input_file.empty()) {
-            throw Exception("only one of 'stdin-file' or 'stdin' allowed");
+        if (!input_file.empty() || input_generator) {
+            throw Exception(only_one_input);
         }
         input.push_back(args[0]);
     }
     else if (directive->name == "stdout") {
         output.push_back(args[0]);
     }
+    else if (directive->name == "thread-sweep") {
+        thread_variable = args[0];
+        for (size_t i = 1; i < args.size(); i++) {
+            auto threads = get_int(args[i]);
+            if (threads <= 0) {
+                throw Exception("invalid thread count '" + args[i] + "'");
+            }
+            thread_counts.push_back(threads);
+        }
+    }
     else if (directive->name == "touch") {
         if (touch_files.find(args[1]) != touch_files.end()) {
             throw Exception("duplicate touch for '" + args[1], "'");
@@ -386,6 +955,36 @@ void Test::process_directive(const Parser::Directive *directive, const std::vect
 }
 
 
+void Test::print_noise() const {
+    std::cout << "noise: load average " << (noise.load_average.empty() ? "unknown" : noise.load_average);
+    std::cout << ", governor " << (noise.governor.empty() ? "unknown" : noise.governor);
+    if (!cpu_set.empty()) {
+        std::cout << ", cpus ";
+        for (size_t i = 0; i < cpu_set.size(); i++) {
+            std::cout << (i > 0 ? "," : "") << cpu_set[i];
+        }
+    }
+    std::cout << ", busy processes: ";
+    if (noise.busy_processes.empty()) {
+        std::cout << "none";
+    }
+    for (size_t i = 0; i < noise.busy_processes.size(); i++) {
+        std::cout << (i > 0 ? ", " : "") << noise.busy_processes[i];
+    }
+    std::cout << "\n";
+}
+
+
+void Test::print_samples(const std::vector<OS::ProcessSample> &samples) const {
+    std::cout << "Resource usage" << variant << ":\n";
+    std::cout << "       time  processes  threads  files          rss         read      written\n";
+    for (const auto &sample : samples) {
+        std::cout << std::setw(11) << format_seconds(sample.time) << std::setw(11) << sample.processes << std::setw(9) << sample.threads << std::setw(7) << sample.open_files;
+        std::cout << std::setw(13) << format_bytes(sample.rss) << std::setw(13) << format_bytes(sample.read_bytes) << std::setw(13) << format_bytes(sample.write_bytes) << "\n";
+    }
+}
+
+
 void Test::print_result(Result result) const {
     switch (result) {
         case PASSED:
@@ -430,6 +1029,10 @@ void Test::print_result(Result result) const {
             std::cout << "ERROR";
     }
     std::cout << "\n";
+
+    if (noise_recorded && (configuration.record_noise == Configuration::ALWAYS || result == FAILED || result == ERROR)) {
+        print_noise();
+    }
 }
 
 
@@ -453,6 +1056,75 @@ void Test::read_features() {
 }
 
 
+std::shared_ptr<DataSource> Test::find_data(const std::string &name) const {
+    auto generator = generators.find(name);
+    if (generator != generators.end()) {
+        return generate_data(name, generator->second);
+    }
+
+    auto data = locate_data(name);
+    if (data) {
+        return data;
+    }
+
+    for (const auto &extension : CompressedDataSource::extensions) {
+        data = locate_data(name + extension);
+        if (data) {
+            return CompressedDataSource::open(data);
+        }
+    }
+
+    throw Exception("can't find input file '" + name + "'");
+}
+
+
+std::shared_ptr<DataSource> Test::locate_data(const std::string &name) const {
+    if (fixtures && !OS::is_absolute(name) && !file_index.file_exists(build_directory, name)) {
+        auto data = fixtures->find(name);
+        if (data) {
+            return data;
+        }
+    }
+
+    auto file_name = locate_file(name);
+    if (file_name.empty()) {
+        return NULL;
+    }
+    return std::make_shared<FileDataSource>(file_name);
+}
+
+
+std::string Test::sandbox_template_key(const std::vector<std::shared_ptr<DataSource>> &inputs) const {
+    if (!sandboxes.templates_enabled() || inputs.empty()) {
+        return "";
+    }
+
+    Digest digest;
+    int64_t size = 0;
+    auto input = inputs.cbegin();
+    for (const auto &file : files) {
+        if (file.read_only || file.input.empty()) {
+            continue;
+        }
+        const auto &data = *(input++);
+        auto identity = data->identity();
+        if (identity.empty()) {
+            return "";
+        }
+        auto data_size = data->size();
+        // Size of decompressed data is not known, but decompressing it is what we want to avoid.
+        size = data_size < 0 || size < 0 ? -1 : size + data_size;
+        auto entry = file.name + '\0' + identity + '\n';
+        digest.update(entry.data(), entry.size());
+    }
+
+    if (size >= 0 && size < configuration.sandbox_template_size) {
+        return "";
+    }
+    return digest.final();
+}
+
+
 void Test::rewrite_lines(const std::vector<Replace> &replacements, std::vector<std::string> *lines) {
     for (auto &line : *lines) {
         for (const auto &replace : replacements) {
@@ -462,8 +1134,197 @@ void Test::rewrite_lines(const std::vector<Replace> &replacements, std::vector<s
 }
 
 
+double Test::run_in_sandbox(int threads) {
+    double seconds;
+
+    enter_sandbox();
+    
+    try {
+        std::vector<std::shared_ptr<DataSource>> staged_inputs;
+        for (const auto &file : files) {
+            if (!file.read_only && !file.input.empty()) {
+                staged_inputs.push_back(find_data(file.input));
+            }
+        }
+        auto template_key = sandbox_template_key(staged_inputs);
+        auto from_template = !template_key.empty() && sandboxes.copy_template(template_key, ".");
+
+        std::vector<OS::FileInfo> read_only_files;
+        std::vector<std::string> staged_files;
+        auto staged_input = staged_inputs.cbegin();
+        for (const auto &file : files) {
+            if (file.read_only) {
+                auto source = find_data(file.input);
+                // Through a link, a buggy program would corrupt the fixture for all later tests.
+                if (!source->file_name().empty() && !OS::is_writable(source->file_name())) {
+                    OS::link_file(source->file_name(), file.name);
+                }
+                else {
+                    OS::copy_file(source.get(), file.name);
+                }
+                read_only_files.push_back(OS::get_file_info(file.name));
+            }
+            else if (!file.input.empty()) {
+                auto data = *(staged_input++);
+                if (!from_template) {
+                    OS::copy_file(data.get(), file.name);
+                    staged_files.push_back(file.name);
+                }
+            }
+        }
+        for (const auto &tree : directory_trees) {
+            OS::ensure_directory(tree.name);
+            if (!tree.input.empty()) {
+                auto source = find_directory(tree.input);
+                auto prefix_length = source.size() + OS::path_separator.size();
+                for (const auto &file : OS::list_files(source)) {
+                    OS::copy_file(file, OS::append_path_component(tree.name, file.substr(prefix_length)));
+                }
+            }
+        }
+        if (!template_key.empty() && !from_template) {
+            sandboxes.add_template(template_key, ".", staged_files);
+        }
+        auto staged_expected = get_staged_expected_files();
+        
+        std::vector<std::string> error_output_got;
+        std::vector<std::string> output_got;
+        OS::Statistics statistics;
+        std::unordered_map<std::string, std::string> sandbox_environment;
+        std::unordered_map<std::string, std::string> thread_environment;
+        
+        OS::Command command;
+        command.arguments = arguments;
+        command.batch_scheduling = configuration.batch_scheduling;
+        command.cpu_max = cpu_max;
+        command.cpu_set = cpu_set;
+        command.environments.push_back(&OS::standard_environment);
+        auto temp_directory = sandboxes.temp_directory(sandbox_name);
+        if (!temp_directory.empty()) {
+            temp_directory = OS::is_absolute(temp_directory) ? temp_directory : OS::append_path_component(build_directory, temp_directory);
+            sandbox_environment["TMPDIR"] = temp_directory;
+            command.environments.push_back(&sandbox_environment);
+        }
+        if (!environment.empty()) {
+            command.environments.push_back(&environment);
+        }
+        if (threads > 0) {
+            auto placeholder = "@" + thread_variable + "@";
+            auto value = std::to_string(threads);
+            for (auto &argument : command.arguments) {
+                std::string::size_type pos = 0;
+                while ((pos = argument.find(placeholder, pos)) != std::string::npos) {
+                    argument.replace(pos, placeholder.size(), value);
+                    pos += value.size();
+                }
+            }
+            thread_environment[thread_variable] = value;
+            command.environments.push_back(&thread_environment);
+        }
+        if (!input.empty()) {
+            command.input = &input;
+        }
+        std::shared_ptr<DataSource> input_data;
+        if (input_generator) {
+            input_data = generate_data("generated stdin", *input_generator);
+        }
+        else if (input_repeat > 1) {
+            auto file = input_file;
+            input_data = std::make_shared<RepeatDataSource>(input_file, [this, file]() { return find_data(file); }, input_repeat, -1);
+        }
+        else if (!input_file.empty()) {
+            input_data = find_data(input_file);
+        }
+        if (input_data) {
+            if (!input_data->file_name().empty()) {
+                command.input_file = input_data->file_name();
+            }
+            else {
+                command.input_data = input_data.get();
+            }
+        }
+        command.isolate = configuration.isolate_processes || memory_max > 0 || cpu_max > 0;
+        if (!limits.empty()) {
+            command.limits = &limits;
+        }
+        command.memory_max = memory_max;
+        command.nice = configuration.nice;
+        command.path.push_back(build_directory);
+        command.path.push_back(OS::append_path_component(configuration.source_directory, ".."));
+        command.file_index = &file_index;
+        if (!preload_library.empty()) {
+            command.preload_library = OS::is_absolute(preload_library) ? preload_library : OS::append_path_component(build_directory, preload_library);
+        }
+        command.program = program;
+        if (configuration.print_results == Configuration::ALWAYS || max_sandbox_size > 0 || max_startup_latency >= 0 || !minimum_throughputs.empty() || sample_interval > 0) {
+            command.statistics = &statistics;
+        }
+        if (configuration.print_results == Configuration::ALWAYS || max_sandbox_size > 0) {
+            // Walking the sandbox while the program runs could disturb performance measurements.
+            command.disk_usage_directories.push_back(".");
+            // Temporary files count towards the sandbox, even though they are kept outside of it.
+            if (!temp_directory.empty()) {
+                command.disk_usage_directories.push_back(temp_directory);
+            }
+        }
+        if (max_sandbox_size > 0) {
+            command.disk_usage_max = max_sandbox_size;
+            // Catches a single runaway file between samples.
+            command.file_size_max = max_sandbox_size;
+        }
+        command.sample_interval = sample_interval;
+        // Read-only files are links to, or copies of, fixtures the test doesn't own.
+        command.disk_usage_excluded = read_only_files;
+
+        auto start = std::chrono::steady_clock::now();
+        auto exit_code_got = OS::run_command(&command, &output_got, &error_output_got);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        
+        if (exit_code != exit_code_got) {
+            failed.push_back("exit status" + variant);
+            if (configuration.print_results != Configuration::NEVER) {
+                std::cout << "Exit code" << variant << " not as expected:\n";
+                std::cout << "-" << exit_code << "\n";
+                std::cout << "+" << exit_code_got << "\n";
+            }
+        }
+        
+        std::vector<Replace> replacements;
+        
+        replacements.push_back(Replace(std::regex("^[^: ]*" + OS::basename(program) + ": "), ""));
+        replacements.insert(replacements.end(), error_output_replace.begin(), error_output_replace.end());
+        
+        rewrite_lines(replacements, &error_output_got);
+        
+        compare_arrays(output, output_got, "Output");
+        compare_arrays(error_output, error_output_got, "Error output");
+        
+        compare_files(staged_expected);
+        check_read_only_files(read_only_files);
+
+        if (command.statistics != NULL) {
+            // Samples can miss the final state.
+            auto usage = OS::get_disk_usage(command.disk_usage_directories, command.disk_usage_excluded);
+            statistics.disk_usage.bytes = std::max(statistics.disk_usage.bytes, usage.bytes);
+            statistics.disk_usage.inodes = std::max(statistics.disk_usage.inodes, usage.inodes);
+            check_statistics(statistics);
+        }
+    }
+    catch (Exception e) {
+        leave_sandbox(configuration.keep_sandbox != Configuration::NEVER);
+        throw;
+    }
+    
+    leave_sandbox(configuration.keep_sandbox == Configuration::ALWAYS || (configuration.keep_sandbox == Configuration::WHEN_FAILED && !failed.empty()));
+    return seconds;
+}
+
+
 Test::Result Test::run() {
     auto result = execute_test();
     print_result(result);
+    digests.save();
+    file_index.save();
+    sandboxes.finish();
     return result;
 }
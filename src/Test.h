@@ -34,13 +34,20 @@
 #ifndef HAD_TEST_H
 #define HAD_TEST_H
 
+#include <memory>
 #include <string>
 #include <regex>
 #include <unordered_map>
 #include <vector>
 
 #include "Configuration.h"
+#include "DataSource.h"
+#include "DigestCache.h"
+#include "FileIndex.h"
+#include "FixtureArchive.h"
+#include "OS.h"
 #include "Parser.h"
+#include "SandboxManager.h"
 
 class Test : ParserConsumer {
 public:
@@ -55,12 +62,31 @@ public:
         std::string name;
         std::string input;
         std::string output;
+        // Linked instead of copied, checked for modification instead of compared.
+        bool read_only;
         
-        File(const std::string &name_, const std::string &input_, const std::string &output_) : name(name_), input(input_), output(output_) { }
+        File(const std::string &name_, const std::string &input_, const std::string &output_, bool read_only_ = false) : name(name_), input(input_), output(output_), read_only(read_only_) { }
         
         bool operator<(File other) const { return name < other.name; }
     };
     
+    struct DirectoryTree {
+        std::string name;
+        std::string input;
+        std::string output;
+
+        DirectoryTree(const std::string &name_, const std::string &input_, const std::string &output_) : name(name_), input(input_), output(output_) { }
+    };
+
+    // Parameters of `GeneratedDataSource`, or of `RepeatDataSource` for pattern `repeat:file`.
+    struct Generator {
+        uint64_t size;
+        std::string pattern;
+        uint64_t seed;
+
+        Generator(uint64_t size_, const std::string &pattern_, uint64_t seed_) : size(size_), pattern(pattern_), seed(seed_) { }
+    };
+
     struct Replace {
         std::regex pattern;
         std::string replacement;
@@ -68,51 +94,111 @@ public:
         Replace(const std::regex &pattern_, const std::string &replacement_) : pattern(pattern_), replacement(replacement_) { }
     };
 
+    struct ThreadRun {
+        int threads;
+        double seconds;
+
+        ThreadRun(int threads_, double seconds_) : threads(threads_), seconds(seconds_) { }
+    };
+
     Test(const std::string &test_case, Configuration configuration_);
     
     Result run();
 
+    std::string find_directory(const std::string &name) const;
     std::string find_file(const std::string &name) const;
+    // Like `find_file`, but also looks in the fixture archive and for compressed files.
+    std::shared_ptr<DataSource> find_data(const std::string &name) const;
     virtual void process_directive(const Parser::Directive *directive, const std::vector<std::string> &args);
 
     Configuration configuration;
+    // Absolute path of the directory nihtest was started in, the sandboxes may live elsewhere.
+    std::string build_directory;
+    DigestCache digests;
+    // Contents of build and source directories.
+    mutable FileIndex file_index;
     std::string name;
     bool run_test;
     
     std::vector<std::string> arguments;
+    double cpu_max;
     std::unordered_map<std::string, int> directories;
+    std::vector<DirectoryTree> directory_trees;
+    std::unordered_map<int, double> minimum_speedups;
+    std::unordered_map<std::string, uint64_t> minimum_throughputs;
     std::unordered_map<std::string, std::string> environment;
     std::vector<std::string> error_output;
     std::vector<Replace> error_output_replace;
     std::string exit_code;
     std::vector<File> files;
+    // Commands generating read-only files, by file name.
+    std::unordered_map<std::string, std::vector<std::string>> generated_files;
+    // Generated data, by the name used as input and output of `files`.
+    std::unordered_map<std::string, Generator> generators;
     std::vector<std::string> input;
     std::unordered_map<char, int> limits;
+    uint64_t max_sandbox_size;
+    double max_startup_latency;
+    std::unordered_map<std::string, uint64_t> maximum_usage;
+    uint64_t memory_max;
     std::vector<std::string> output;
     std::string input_file;
+    std::shared_ptr<Generator> input_generator;
+    uint64_t input_repeat;
     std::vector<std::string> precheck_command;
     std::string preload_library;
     std::string program;
     std::vector<std::string> required_features;
+    double sample_interval;
+    std::vector<int> thread_counts;
+    std::string thread_variable;
     std::unordered_map<std::string, time_t> touch_files;
     
 private:
     static const std::vector<Parser::Directive> directives;
 
     void compare_arrays(const std::vector<std::string> &expected, const std::vector<std::string> &got, const std::string &what);
-    void compare_files();
+    void check_speedups(const std::vector<ThreadRun> &runs);
+    void check_read_only_files(const std::vector<OS::FileInfo> &staged);
+    void check_statistics(const OS::Statistics &statistics);
+    // `staged_expected` are files staged with their expected contents, and their status after staging.
+    void compare_files(const std::unordered_map<std::string, OS::FileInfo> &staged_expected);
     void enter_sandbox();
     Result execute_test();
+    std::shared_ptr<DataSource> generate_data(const std::string &name, const Generator &generator) const;
+    // Run commands of `generated_files` whose output is not cached yet, and set input of their files to the cached output.
+    void generate_files();
+    double get_double(const std::string &string);
     int get_int(const std::string &string);
+    uint64_t get_size(const std::string &string);
+    std::unordered_map<std::string, OS::FileInfo> get_staged_expected_files() const;
     bool has_feature(const std::string &name);
+    bool has_input() const { return !input.empty() || !input_file.empty() || input_generator; }
     void leave_sandbox(bool keep);
+    // Find data in build directory, fixture archive, or source directory, NULL if not found.
+    std::shared_ptr<DataSource> locate_data(const std::string &name) const;
+    // Find file in build or source directory, empty if not found.
+    std::string locate_file(const std::string &name) const;
     std::string make_filename(const std::string &directory, const std::string name) const;
+    void print_noise() const;
+    void print_samples(const std::vector<OS::ProcessSample> &samples) const;
     void print_result(Result result) const;
     void read_features();
     void rewrite_lines(const std::vector<Replace> &replacements, std::vector<std::string> *lines);
+    double run_in_sandbox(int threads);
+    // Get key of the template for staging `inputs`, the data for `files`, empty if none should be used.
+    std::string sandbox_template_key(const std::vector<std::shared_ptr<DataSource>> &inputs) const;
     
+    std::vector<int> cpu_set;
+    std::shared_ptr<FixtureArchive> fixtures;
+    // Cache entries of `generated_files`, by file name.
+    std::unordered_map<std::string, std::string> generated_entries;
     bool in_sandbox;
+    OS::SystemNoise noise;
+    bool noise_recorded;
+    std::string variant;
     std::string sandbox_name;
+    SandboxManager sandboxes;
     std::vector<std::string> failed;
 
     std::unordered_set<std::string> features;
@@ -79,13 +79,13 @@ enum {
     OPT_SETUP_ONLY
 };
 
-#define OPTIONS "ChVv"
+#define OPTIONS "C:hVv"
 
 struct option options[] = {
     { "help", 0, 0, 'h' },
     { "version", 0, 0, 'V' },
     
-    { "config-file", 0, 0, 'C' },
+    { "config-file", 1, 0, 'C' },
     { "keep-broken", 0, 0, OPT_KEEP_BROKEN },
     { "no-cleanup", 0, 0, OPT_NO_CLEANUP },
     { "quiet", 0, 0, 'q' },
@@ -122,7 +122,7 @@ int main(int argc, char *argv[]) {
             exit(0);
             
         case 'C': // config-file
-            configuration_file = argv[optind];
+            configuration_file = optarg;
             break;
 
         case 'q': // quiet